@@ -1,37 +1,63 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
 #define DEF_PROTO_REQ_NAMES
 #include "proto.h"
 
 
+/* max number of string chunks sent with a single write */
+#define SEND_STR_BATCH	16
+
 int spnav_send_str(int fd, int req, const char *str)
 {
-	int len;
-	struct reqresp rr = {0};
+	int len, sz, wr, count = 0;
+	char *ptr;
+	struct reqresp pkt[SEND_STR_BATCH];
 
 	if(fd == -1) {
 		return -1;
 	}
 
 	len = str ? strlen(str) : 0;
-	rr.type = req;
-	rr.data[6] = len;
+	memset(pkt, 0, sizeof pkt);
+	pkt[0].data[6] = len;
 
+	/* pack the chunks into pkt, and send them with a single write */
 	do {
+		pkt[count].type = req;
 		if(str) {
-			memcpy(rr.data, str, len > REQSTR_CHUNK_SIZE ? REQSTR_CHUNK_SIZE : len);
+			memcpy(pkt[count].data, str, len > REQSTR_CHUNK_SIZE ? REQSTR_CHUNK_SIZE : len);
 		}
-		write(fd, &rr, sizeof rr);
 		str += REQSTR_CHUNK_SIZE;
 		len -= REQSTR_CHUNK_SIZE;
-		rr.data[6] = len | REQSTR_CONT_BIT;
+
+		if(++count >= SEND_STR_BATCH || len <= 0) {
+			ptr = (char*)pkt;
+			sz = count * sizeof *pkt;
+			while(sz > 0) {
+				if((wr = write(fd, ptr, sz)) <= 0) {
+					if(wr == -1 && errno == EINTR) continue;
+					return -1;
+				}
+				ptr += wr;
+				sz -= wr;
+			}
+			memset(pkt, 0, sizeof pkt);
+			count = 0;
+		}
+		pkt[count].data[6] = len | REQSTR_CONT_BIT;
 	} while(len > 0);
 
 	return 0;
 }
 
 int spnav_recv_str(struct reqresp_strbuf *sbuf, struct reqresp *rr)
+{
+	return spnav_recv_str_buf(sbuf, rr, 0, 0);
+}
+
+int spnav_recv_str_buf(struct reqresp_strbuf *sbuf, struct reqresp *rr, char *buf, int bufsz)
 {
 	int len;
 
@@ -39,12 +65,20 @@ int spnav_recv_str(struct reqresp_strbuf *sbuf, struct reqresp *rr)
 	len = REQSTR_REMLEN(rr);
 
 	if(REQSTR_FIRST(rr)) {
-		/* first packet, allocate buffer */
-		free(sbuf->buf);
+		/* first packet, use the caller's buffer if it fits, or allocate one */
+		if(!sbuf->extbuf) {
+			free(sbuf->buf);
+		}
 		sbuf->expect = len;
 		sbuf->size = sbuf->expect + 1;
-		if(!(sbuf->buf = malloc(sbuf->size))) {
-			return -1;
+		if(buf && sbuf->size <= bufsz) {
+			sbuf->buf = buf;
+			sbuf->extbuf = 1;
+		} else {
+			sbuf->extbuf = 0;
+			if(!(sbuf->buf = malloc(sbuf->size))) {
+				return -1;
+			}
 		}
 		sbuf->endp = sbuf->buf;
 	}
@@ -1,6 +1,7 @@
 #ifndef PROTO_H_
 #define PROTO_H_
 
+#include <stddef.h>
 #if defined(__sgi) || defined(__sun)
 #include <inttypes.h>
 #else
@@ -8,7 +9,7 @@
 #endif
 
 /* maximum supported protocol version */
-#define MAX_PROTO_VER	1
+#define MAX_PROTO_VER	2
 
 enum {
 	UEV_MOTION,
@@ -27,10 +28,43 @@ struct reqresp {
 	int32_t data[7];
 };
 
+/* Shared memory event transport (protocol v2)
+ * A daemon which supports it, attaches a file descriptor (SCM_RIGHTS) to its
+ * response to REQ_CHANGE_PROTO v2, for a shared memory object holding a
+ * shm_ring. From then on, it writes events to the ring instead of the socket,
+ * which only carries request responses. Whenever it writes an event to an
+ * empty ring, it also sends a UEV_SHM_WAKE packet through the socket, to wake
+ * up the client if it's waiting for input. A v2 response without a file
+ * descriptor means events keep going through the socket, as in v1.
+ *
+ * The client must update rd after consuming events, and check wr once more
+ * after that, before waiting on the socket. The daemon checks rd after
+ * updating wr, to decide whether to send a wakeup. Both accesses must be
+ * sequentially consistent, so that at least one side sees the other's update.
+ */
+#define SHM_RING_MAGIC	0x53505231
+#define UEV_SHM_WAKE	0x100
+
+struct shm_ring {
+	uint32_t magic;
+	uint32_t size;		/* capacity in events, power of two */
+	uint32_t dropped;	/* events dropped by the daemon because the ring was full */
+	uint32_t pad0[13];
+	uint32_t wr;		/* written only by the daemon */
+	uint32_t pad1[15];
+	uint32_t rd;		/* written only by the client */
+	uint32_t pad2[15];
+	int32_t ev[1][8];	/* size event packets */
+};
+
+/* size of the shared memory object for a ring of n events */
+#define SHM_RING_BYTES(n)	(offsetof(struct shm_ring, ev) + (n) * sizeof(int32_t[8]))
+
 struct reqresp_strbuf {
 	char *buf, *endp;
 	int size;
 	int expect;
+	int extbuf;		/* buf is caller-provided storage (see spnav_recv_str_buf) */
 };
 
 #define REQ_TAG			0x7faa0000
@@ -135,6 +169,12 @@ enum {
 
 int spnav_send_str(int fd, int req, const char *str);
 int spnav_recv_str(struct reqresp_strbuf *sbuf, struct reqresp *rr);
+/* Same as spnav_recv_str, but reassembles the string directly into buf, if it
+ * fits, including the terminator. Otherwise a buffer is allocated as usual.
+ * sbuf->extbuf is set if buf was used, in which case sbuf->buf must not be
+ * freed.
+ */
+int spnav_recv_str_buf(struct reqresp_strbuf *sbuf, struct reqresp *rr, char *buf, int bufsz);
 
 #ifdef DEF_PROTO_REQ_NAMES
 const char *spnav_reqnames_1000[] = {
@@ -24,1093 +24,5229 @@ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
 IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
 OF SUCH DAMAGE.
 */
+#if defined(__linux__) && !defined(_POSIX_C_SOURCE)
+/* needed for clock_gettime and pthreads with -std=c89 */
+#define _POSIX_C_SOURCE	200112L
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <ctype.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <sys/un.h>
-#include <sys/select.h>
+#include <sys/mman.h>
+#include <poll.h>
 #include "spnav.h"
 #include "proto.h"
 
 /* default timeout for request responses*/
 #define TIMEOUT	400
+/* max number of requests sent in a burst by the bulk config functions */
+#define MAX_PIPELINE	64
+/* capacity of the queue of responses received while reading events */
+#define RESPQ_SIZE		(MAX_PIPELINE * 2)
+/* max number of asynchronous requests pending at any time */
+#define MAX_ASYNC_REQ	16
+/* how long to wait for the protocol change response when opening */
+#define OPEN_PROTO_TIMEOUT	300
+/* retry interval for connections to a daemon with a full listen backlog */
+#define OPEN_RETRY_MSEC	10
+/* maximum number of daemon sockets in the protocol version cache */
+#define PROTO_CACHE_MAX	16
+/* receive buffer size for batched event reads, in packets */
+#define RXBUF_EVENTS	128
+/* default event queue capacity (see spnav_queue_size) */
+#define DEF_QUEUE_SIZE	256
+/* maximum number of devices tracked per connection */
+#define MAX_DEVICES	16
+/* max number of per-axis/per-button entries kept in the config cache */
+#define CFG_TABLE_SIZE	64
 /* default socket path */
 #define SPNAV_SOCK_PATH "/var/run/spnav.sock"
 
+#ifdef __ATOMIC_SEQ_CST
+#define ATOMIC_LOAD(x)		__atomic_load_n(&(x), __ATOMIC_SEQ_CST)
+#define ATOMIC_STORE(x, v)	__atomic_store_n(&(x), (v), __ATOMIC_SEQ_CST)
+#define ATOMIC_XCHG(x, v)	__atomic_exchange_n(&(x), (v), __ATOMIC_SEQ_CST)
+#define ATOMIC_LOAD_ACQ(x)	__atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define ATOMIC_LOAD_RLX(x)	__atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define ATOMIC_STORE_REL(x, v)	__atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#define ATOMIC_STORE_RLX(x, v)	__atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+#define ATOMIC_FENCE_ACQ()	__atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define ATOMIC_FENCE_REL()	__atomic_thread_fence(__ATOMIC_RELEASE)
+#else
+/* no atomic builtins, only good enough for single-threaded use */
+#define ATOMIC_LOAD(x)		(x)
+#define ATOMIC_STORE(x, v)	((x) = (v))
+#define ATOMIC_LOAD_ACQ(x)	(x)
+#define ATOMIC_LOAD_RLX(x)	(x)
+#define ATOMIC_STORE_REL(x, v)	((x) = (v))
+#define ATOMIC_STORE_RLX(x, v)	((x) = (v))
+#define ATOMIC_FENCE_ACQ()
+#define ATOMIC_FENCE_REL()
+#endif
+
+#ifdef SPNAV_USE_THREADS
+#include <pthread.h>
+
+#define DEV_LOCK(ctx)	pthread_mutex_lock(&(ctx)->dev_lock)
+#define DEV_UNLOCK(ctx)	pthread_mutex_unlock(&(ctx)->dev_lock)
+#define CFG_LOCK(ctx)	pthread_mutex_lock(&(ctx)->cfg_lock)
+#define CFG_UNLOCK(ctx)	pthread_mutex_unlock(&(ctx)->cfg_lock)
+#define REQ_LOCK(ctx)	pthread_mutex_lock(&(ctx)->req_lock)
+#define REQ_UNLOCK(ctx)	pthread_mutex_unlock(&(ctx)->req_lock)
+#define REC_LOCK(ctx)	pthread_mutex_lock(&(ctx)->rec_lock)
+#define REC_UNLOCK(ctx)	pthread_mutex_unlock(&(ctx)->rec_lock)
+
+/* capacity of the reader thread event handoff ring (must be a power of two)
+ * and of its response mailbox
+ */
+#define THR_RING_SIZE	1024
+#define THR_MBOX_SIZE	RESPQ_SIZE
+
+static int thr_read_events(struct spnav_ctx *ctx, spnav_event *evbuf, struct spnav_timestamp *tsbuf,
+		int max, int block);
+static int thr_wait_resp(struct spnav_ctx *ctx, void *buf, int sz, int timeout_ms);
+static void thr_flush_resp(struct spnav_ctx *ctx);
+static void thr_stop(struct spnav_ctx *ctx);
+#endif
+
+#if defined(SPNAV_USE_SHM) && !defined(__ATOMIC_SEQ_CST)
+/* the shared memory event ring relies on sequentially consistent atomics */
+#undef SPNAV_USE_SHM
+#endif
+
+#ifdef SPNAV_USE_SHM
+#include <sys/uio.h>
+
+/* protocol version requested at open */
+#define CLIENT_PROTO_VER	MAX_PROTO_VER
+/* true if there are events in the shared memory ring, not read yet */
+#define SHM_PENDING(ctx)	((ctx)->shm && ATOMIC_LOAD((ctx)->shm->wr) != (ctx)->shm->rd)
+#else
+#define CLIENT_PROTO_VER	1
+#define SHM_PENDING(ctx)	0
+#endif
+
+#ifndef SPNAV_USE_THREADS
+#define DEV_LOCK(ctx)
+#define DEV_UNLOCK(ctx)
+#define CFG_LOCK(ctx)
+#define CFG_UNLOCK(ctx)
+#define REQ_LOCK(ctx)
+#define REQ_UNLOCK(ctx)
+#define REC_LOCK(ctx)
+#define REC_UNLOCK(ctx)
+#endif
+
 #ifdef SPNAV_USE_X11
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 
-static Window get_daemon_window(Display *dpy);
+static Window get_daemon_window(struct spnav_ctx *ctx);
 static int catch_badwin(Display *dpy, XErrorEvent *err);
 
 
-static Display *dpy;
-static Window app_win;
-static Atom motion_event, button_press_event, button_release_event, command_event;
-
 enum {
 	CMD_APP_WINDOW = 27695,
 	CMD_APP_SENS
 };
 
-#define IS_OPEN		(dpy || (sock != -1))
+#define IS_OPEN(ctx)	((ctx)->dpy || (ctx)->sock != -1)
 #else
-#define IS_OPEN		(sock != -1)
+#define IS_OPEN(ctx)	((ctx)->sock != -1)
+#endif
+/* true for contexts replaying an event log (see spnav_open_replay) */
+#define IS_REPLAY(ctx)	((ctx)->rp_data != 0)
+
+static int read_event(struct spnav_ctx *ctx, spnav_event *event, int block);
+static int read_events(struct spnav_ctx *ctx, spnav_event *evbuf, struct spnav_timestamp *tsbuf,
+		int max, int block);
+static int queue_pending(struct spnav_ctx *ctx, int block);
+static void stash_resp(struct spnav_ctx *ctx, const int32_t *pkt);
+static void proc_resp(struct spnav_ctx *ctx, const int32_t *pkt);
+static int proc_event(struct spnav_ctx *ctx, int *data, spnav_event *event);
+
+static void enqueue_event(struct spnav_ctx *ctx, const spnav_event *event, const struct spnav_timestamp *ts);
+static void dequeue_event(struct spnav_ctx *ctx, spnav_event *event, struct spnav_timestamp *ts);
+
+static void get_time(struct spnav_timestamp *ts);
+
+static void rec_event(struct spnav_ctx *ctx, const int32_t *data);
+static int rec_stop(struct spnav_ctx *ctx);
+static int replay_fill(struct spnav_ctx *ctx, int block);
+#ifdef SPNAV_USE_THREADS
+static int replay_timeout(struct spnav_ctx *ctx);
 #endif
 
-static int read_event(int s, spnav_event *event);
-static int proc_event(int *data, spnav_event *event);
+static void update_state(struct spnav_ctx *ctx, const spnav_event *ev, const struct spnav_timestamp *ts);
+static void reset_state(struct spnav_ctx *ctx);
+
+static void track_device(struct spnav_ctx *ctx, const struct spnav_event_dev *ev);
+static void dev_prefetch(struct spnav_ctx *ctx);
+static int dev_collect(struct spnav_ctx *ctx);
+static void dev_free_info(struct spnav_ctx *ctx);
+
+static int cfg_cache_get(struct spnav_ctx *ctx, int req, struct reqresp *rr);
+static void cfg_cache_update(struct spnav_ctx *ctx, int req, const struct reqresp *rr,
+		unsigned int gen);
+static void cfg_cache_event(struct spnav_ctx *ctx, const struct spnav_event_cfg *ev);
+static int cfg_batchable(int req);
+static int cfg_batch_add(struct spnav_ctx *ctx, int req, const struct reqresp *rr);
+
+static int async_resp(struct spnav_ctx *ctx, const int32_t *pkt, spnav_event *ev);
+static int async_wait(struct spnav_ctx *ctx, int block);
+static int async_take(struct spnav_ctx *ctx, int token, spnav_request_callback *cb, void **cls);
+static int async_filter(struct spnav_ctx *ctx, spnav_event *evbuf, struct spnav_timestamp *tsbuf,
+		int count);
+
+static void flush_resp(struct spnav_ctx *ctx);
+static int wait_resp(struct spnav_ctx *ctx, void *buf, int sz, int timeout_ms);
+static int request(struct spnav_ctx *ctx, int req, struct reqresp *rr, int timeout_ms);
+static int request_str(struct spnav_ctx *ctx, int req, char *buf, int bufsz, int timeout_ms);
+static int request_table(struct spnav_ctx *ctx, int req, int first, int count,
+		const int *setvals, int *getvals, int timeout_ms);
+
+
+struct queued_event {
+	spnav_event ev;
+	struct spnav_timestamp ts;	/* receive time */
+};
 
-static void flush_resp(void);
-static int wait_resp(void *buf, int sz, int timeout_ms);
-static int request(int req, struct reqresp *rr, int timeout_ms);
-static int request_str(int req, char *buf, int bufsz, int timeout_ms);
+/* asynchronous open states (see spnav_open_async) */
+enum { OPEN_IDLE, OPEN_CONNECTING, OPEN_HANDSHAKE };
 
+struct device {
+	int id;			/* daemon device id, -1 if unknown */
+	int type;
+	unsigned int usbid[2];
+	int remote;		/* non-zero for the device the daemon answers queries for */
+};
 
-struct event_node {
-	spnav_event event;
-	struct event_node *next;
+/* descriptor of the device the daemon answers queries for (see dev_info) */
+struct devinfo {
+	char *name, *path;		/* null if not available */
+	int naxes, nbuttons;	/* -1 if not available */
+	int type;
+	unsigned int usbid[2];
+	int usb;				/* non-zero if usbid is valid */
 };
+enum { DINFO_NONE, DINFO_PENDING, DINFO_VALID };
 
-/* only used for non-X mode, with spnav_remove_events */
-static struct event_node *ev_queue, *ev_queue_tail;
+/* asynchronous request slot (see spnav_request_async). A slot is in use while
+ * the request is in flight (waiting for the daemon to respond), or its
+ * completion event is queued, waiting to be delivered. Orphaned requests are
+ * still in flight, but nobody is interested in the response any more, because
+ * they were canceled, or their deadline expired.
+ */
+struct async_req {
+	int token;				/* 0 for free slots */
+	int req;
+	unsigned int seq;		/* order in which requests were sent */
+	int inflight, queued, orphan;
+	int has_deadline;
+	struct spnav_timestamp deadline;
+	unsigned int cfg_gen;	/* see cfg_cache_update */
+	spnav_request_callback cb;
+	void *cls;
+};
 
-/* AF_UNIX socket used for alternative communication with daemon */
-static int sock = -1;
-static int proto;
+/* config cache: one slot per REQ_GCFG_* request, in the order they're defined
+ * in proto.h, where every get request follows the corresponding set request
+ */
+#define CFG_NUM			((REQ_GCFG_REPEAT - REQ_GCFG_SENS) / 2 + 1)
+#define CFG_SLOT(req)	(((req) - REQ_GCFG_SENS) / 2)
+/* per-axis and per-button tables in the config cache */
+enum { CFG_TAB_DEADZONE, CFG_TAB_AXISMAP, CFG_TAB_BNMAP, CFG_TAB_BNACTION, CFG_TAB_KBMAP, CFG_NUM_TABLES };
+
+struct cfg_cache {
+	int32_t val[CFG_NUM][6];
+	unsigned int valid;		/* one bit per val slot */
+	int32_t tab[CFG_NUM_TABLES][CFG_TABLE_SIZE];
+	unsigned char tab_valid[CFG_NUM_TABLES][CFG_TABLE_SIZE];
+};
 
-static int connect_afunix(int s, const char *path)
-{
-	struct sockaddr_un addr = {0};
+/* Connection context. Everything related to a connection to the daemon lives
+ * in here, and separate contexts share no state, so they can be used from
+ * different threads independently. The locks below only synchronize a context
+ * with its own reader thread (see spnav_ctx_reader_thread). The old API
+ * operates on a default context (defctx).
+ */
+struct spnav_ctx {
+	/* AF_UNIX socket used for alternative communication with daemon */
+	int sock;
+	int proto;
 
-	addr.sun_family = AF_UNIX;
-	strncpy(addr.sun_path, path, sizeof addr.sun_path - 1);
+	/* asynchronous open state. The socket stays in open_sock, until the
+	 * protocol negotiation completes.
+	 */
+	int open_state, open_sock, open_path;
+	struct sockaddr_un open_addr;
+	/* daemon socket identity, and cached protocol version (-1 if unknown) */
+	unsigned long open_ino;
+	long open_ctime;
+	int open_cached;
+	struct spnav_timestamp open_deadline;
+
+	/* fixed-capacity event ring buffer, allocated on open.
+	 * only used for non-X mode
+	 */
+	struct queued_event *evq;
+	int evq_size, evq_rd, evq_count;
+	unsigned long evq_dropped;
 
-	return connect(s, (struct sockaddr*)&addr, sizeof addr);
-}
+	/* motion event coalescing mode (see spnav_coalesce) */
+	int coalesce;
 
-int spnav_open(void)
+	/* current device state (see spnav_get_state), published through a
+	 * seqlock: state_seq is odd while update_state is modifying cur_state.
+	 * There is only ever one writer; the thread decoding events.
+	 */
+	struct spnav_state cur_state;
+	unsigned int state_seq;
+
+	/* client-side device table (see spnav_num_devices), updated from device
+	 * events as they are decoded, and seeded with the device the daemon
+	 * reports, the first time it's needed. Protected by dev_lock, because the
+	 * reader thread might be decoding events while the application looks at it.
+	 */
+	struct device devs[MAX_DEVICES];
+	int num_devs, sel_dev, devs_seeded;
+
+	/* Device descriptor cache. The requests for the full descriptor are sent
+	 * in a single burst at open, and their responses are collected the first
+	 * time they're needed (dinfo_state is DINFO_PENDING until then), or
+	 * before any other request. dinfo_stale is set when a device event is
+	 * decoded (possibly by the reader thread), and causes the descriptor to be
+	 * fetched again by the next device query.
+	 */
+	struct devinfo dinfo;
+	int dinfo_state, dinfo_stale;
+
+	/* Asynchronous requests (see spnav_request_async). The daemon responds to
+	 * requests in order, so responses are matched to the oldest request in
+	 * flight of the same type. areq_live counts the slots in use, to skip all
+	 * async processing when there are none. Protected by req_lock, because the
+	 * reader thread matches responses to requests.
+	 */
+	struct async_req areq[MAX_ASYNC_REQ];
+	int areq_live, areq_token;
+	unsigned int areq_seq;
+
+	/* event mask requested by the application (see spnav_evmask) */
+	unsigned int evmask;
+	/* client-side config cache (see spnav_cfg_*). It's kept coherent by
+	 * configuration change events, which are enabled the first time it's
+	 * used, and filtered out if the application didn't ask for them.
+	 * cfgc_state is 0 before the first use, 1 when the cache is active, and -1
+	 * if it can't be used. cfgc_gen is incremented by every config event, to
+	 * avoid caching responses which might have been superseded by one.
+	 * Protected by cfg_lock, for the same reason as the device table.
+	 */
+	struct cfg_cache cfgc;
+	int cfgc_state;
+	unsigned int cfgc_gen;
+
+	/* config set requests queued between spnav_cfg_begin and
+	 * spnav_cfg_commit. cfgb_size is the allocated size of cfgb, which is
+	 * kept around for the next batch.
+	 */
+	struct reqresp *cfgb;
+	int cfgb_active, cfgb_count, cfgb_size;
+
+	/* event log being recorded (see spnav_record_start). rec_time is the time
+	 * of the last recorded event, as it will be reconstructed from the log, and
+	 * rec_motion the fields of the last motion event, which the next one is
+	 * delta-encoded against. Protected by rec_lock, because events might be
+	 * decoded by the reader thread.
+	 */
+	FILE *rec_fp;
+	int rec_err;
+	struct spnav_timestamp rec_time;
+	int32_t rec_motion[7];
+
+	/* Event log being replayed (see spnav_open_replay), mapped in memory, in
+	 * place of the daemon socket. rp_pos is the offset of the next record
+	 * after rp_pkt, which holds the next event (if rp_have is set), decoded
+	 * ahead of time to find out when it's due. rp_time is the recorded time of
+	 * the last decoded event, rp_base the time recording started, and rp_start
+	 * the time replay started.
+	 */
+	const unsigned char *rp_data;
+	size_t rp_size, rp_pos;
+	double rp_speed;
+	int32_t rp_pkt[8];
+	int rp_have;
+	int32_t rp_motion[7];
+	struct spnav_timestamp rp_time, rp_base, rp_start;
+
+#ifdef SPNAV_USE_SHM
+	/* Shared memory event ring (protocol v2), mapped at open if the daemon
+	 * passed one during the handshake (open_shmfd). When it's mapped, events
+	 * are copied from the ring to rxbuf, and the socket only carries request
+	 * responses, and wakeups for when the ring goes from empty to non-empty.
+	 * shm_size is the ring capacity in events, validated at open, and shm_len
+	 * the size of the mapping in bytes.
+	 */
+	struct shm_ring *shm;
+	unsigned int shm_size;
+	size_t shm_len;
+	int open_shmfd;
+#endif
+
+	/* receive buffer for reading multiple packets with a single read call.
+	 * rx_start and rx_end are byte offsets delimiting data not consumed yet.
+	 * Any partial packet left at the end of a read, is kept for the next one.
+	 */
+	int32_t rxbuf[RXBUF_EVENTS * 8];
+	int rx_start, rx_end;
+	/* time of the last read into rxbuf, used to timestamp the events in it */
+	struct spnav_timestamp rx_time;
+	/* request responses found while reading events, kept for wait_resp */
+	struct reqresp respq[RESPQ_SIZE];
+	int respq_rd, respq_count;
+	/* receive time of the last event returned by spnav_wait/poll_event */
+	struct spnav_timestamp last_ev_time;
+
+#ifdef SPNAV_USE_THREADS
+	/* Background reader thread state (see spnav_reader_thread). The reader
+	 * thread owns the socket receive path (rxbuf) while it's running. It hands
+	 * events over to the application through a lock-free single-producer,
+	 * single-consumer ring (thr_ring, thr_rd, thr_wr), and request responses
+	 * through a small mailbox protected by thr_mbox_lock.
+	 * thr_wake is set by the reader thread when it writes a byte to
+	 * thr_wakepipe, to wake up the application, and cleared by the application
+	 * when it finds the ring empty and reads it back. thr_ctlpipe is used to
+	 * stop the thread.
+	 */
+	int thr_running;
+	pthread_t thr;
+	struct queued_event *thr_ring;
+	unsigned int thr_rd, thr_wr;
+	int thr_wake, thr_eof;
+	unsigned long thr_dropped;
+	int thr_wakepipe[2], thr_ctlpipe[2];
+
+	pthread_mutex_t thr_mbox_lock;
+	pthread_cond_t thr_mbox_cond;
+	struct reqresp thr_mbox[THR_MBOX_SIZE];
+	int thr_mbox_rd, thr_mbox_count;
+
+	pthread_mutex_t dev_lock;
+	pthread_mutex_t cfg_lock;
+	pthread_mutex_t req_lock;
+	pthread_mutex_t rec_lock;
+#endif
+
+#ifdef SPNAV_USE_X11
+	Display *dpy;
+	Window app_win;
+	Atom motion_event, button_press_event, button_release_event, command_event;
+#endif
+};
+
+/* default context, used by the functions without a ctx argument */
+static struct spnav_ctx defctx;
+static int defctx_valid;
+
+static void init_ctx(struct spnav_ctx *ctx)
 {
-	int s, cmd;
-	char *path;
-	FILE *fp;
-	char buf[256], *ptr;
+	memset(ctx, 0, sizeof *ctx);
+	ctx->sock = ctx->open_sock = -1;
+	ctx->evq_size = DEF_QUEUE_SIZE;
+#ifdef SPNAV_USE_SHM
+	ctx->open_shmfd = -1;
+#endif
+#ifdef SPNAV_USE_THREADS
+	pthread_mutex_init(&ctx->dev_lock, 0);
+	pthread_mutex_init(&ctx->cfg_lock, 0);
+	pthread_mutex_init(&ctx->req_lock, 0);
+	pthread_mutex_init(&ctx->rec_lock, 0);
+#endif
+}
 
-	if(IS_OPEN) {
-		return -1;
-	}
+static void destroy_ctx(struct spnav_ctx *ctx)
+{
+#ifdef SPNAV_USE_THREADS
+	pthread_mutex_destroy(&ctx->dev_lock);
+	pthread_mutex_destroy(&ctx->cfg_lock);
+	pthread_mutex_destroy(&ctx->req_lock);
+	pthread_mutex_destroy(&ctx->rec_lock);
+#endif
+	free(ctx);
+}
 
-	if(!(ev_queue = malloc(sizeof *ev_queue))) {
-		return -1;
+static struct spnav_ctx *get_defctx(void)
+{
+	if(!defctx_valid) {
+		init_ctx(&defctx);
+		defctx_valid = 1;
 	}
-	ev_queue->next = 0;
-	ev_queue_tail = ev_queue;
+	return &defctx;
+}
 
-	if((s = socket(PF_UNIX, SOCK_STREAM, 0)) == -1) {
-		return -1;
+/* Connects socket s to the daemon socket at path, or to the address already
+ * stored in addr, if path is null.
+ */
+static int connect_afunix(int s, struct sockaddr_un *addr, const char *path)
+{
+	if(path) {
+		memset(addr, 0, sizeof *addr);
+		addr->sun_family = AF_UNIX;
+		strncpy(addr->sun_path, path, sizeof addr->sun_path - 1);
 	}
+	return connect(s, (struct sockaddr*)addr, sizeof *addr);
+}
 
-	/* heed SPNAV_SOCKET environment variable if it's defined */
-	if((path = getenv("SPNAV_SOCKET"))) {
-		if(connect_afunix(s, path) == 0) goto success;
-	}
+/* Returns the idx-th candidate daemon socket path, in order of preference, or
+ * a null pointer if there are no more candidates. buf is used for paths read
+ * from the config file.
+ */
+static const char *sock_path(int idx, char *buf, int bufsz)
+{
+	char *path, *ptr;
+	FILE *fp;
 
-	/* hacky config file parser, to look for socket = <path> in /etc/spnavrc */
-	if((fp = fopen("/etc/spnavrc", "rb"))) {
-		path = 0;
-		while(fgets(buf, sizeof buf, fp)) {
-			ptr = buf;
-			while(*ptr && isspace(*ptr)) ptr++;
-			if(!*ptr || *ptr == '#') continue;	/* comment or empty line */
+	switch(idx) {
+	case 0:
+		/* heed SPNAV_SOCKET environment variable if it's defined */
+		if((path = getenv("SPNAV_SOCKET"))) {
+			return path;
+		}
+		break;
 
-			if(memcmp(ptr, "socket", 6) == 0 && (ptr = strchr(ptr, '='))) {
-				while(*++ptr && isspace(*ptr));
-				if(!*ptr) continue;
-				path = ptr;
-				ptr += strlen(ptr) - 1;
-				while(ptr > path && isspace(*ptr)) *ptr-- = 0;
-				break;
+	case 1:
+		/* hacky config file parser, to look for socket = <path> in /etc/spnavrc */
+		if((fp = fopen("/etc/spnavrc", "rb"))) {
+			path = 0;
+			while(fgets(buf, bufsz, fp)) {
+				ptr = buf;
+				while(*ptr && isspace(*ptr)) ptr++;
+				if(!*ptr || *ptr == '#') continue;	/* comment or empty line */
+
+				if(memcmp(ptr, "socket", 6) == 0 && (ptr = strchr(ptr, '='))) {
+					while(*++ptr && isspace(*ptr));
+					if(!*ptr) continue;
+					path = ptr;
+					ptr += strlen(ptr) - 1;
+					while(ptr > path && isspace(*ptr)) *ptr-- = 0;
+					break;
+				}
 			}
+			fclose(fp);
+			if(path) return path;
 		}
-		if(path && connect_afunix(s, path) == 0) goto success;
-	}
-
-	/* by default use SPNAV_SOCK_PATH (see top of this file) */
-	if(connect_afunix(s, SPNAV_SOCK_PATH) == -1) {
-		close(s);
-		return -1;
-	}
+		break;
 
-success:
-	sock = s;
-	proto = 0;
+	case 2:
+		/* by default use SPNAV_SOCK_PATH (see top of this file) */
+		return SPNAV_SOCK_PATH;
 
-	/* send protocol change request and wait for a response.
-	 * if we time out, assume we're talking with an old version of spacenavd,
-	 * which took our packet as a sensitivity value, so restore sensitivity to
-	 * 1.0 and continue with protocol v0
-	 */
-	cmd = REQ_TAG | REQ_CHANGE_PROTO | MAX_PROTO_VER;
-	write(s, &cmd, sizeof cmd);
-	if(wait_resp(&cmd, sizeof cmd, 300) == -1) {
-		spnav_sensitivity(1.0f);
-	} else {
-		proto = cmd & 0xff;
+	default:
+		return 0;
 	}
-	return 0;
+	return "";	/* nothing for this one, skip to the next */
 }
 
-#ifdef SPNAV_USE_X11
-int spnav_x11_open(Display *display, Window win)
+/* Protocol version cache. Negotiating the protocol version with an old daemon
+ * (protocol v0) means waiting for a response which never comes, so the outcome
+ * of each negotiation is kept in $XDG_RUNTIME_DIR/libspnav-proto, one line per
+ * daemon socket: "<proto> <inode> <ctime> <socket path>". The socket inode
+ * number and change time identify the daemon instance; a restarted daemon
+ * creates a new socket, which invalidates the entry.
+ */
+static int proto_cache_file(char *buf, int bufsz)
 {
-	if(IS_OPEN) {
+	const char *dir;
+
+	if(!(dir = getenv("XDG_RUNTIME_DIR")) || !*dir) {
 		return -1;
 	}
-
-	dpy = display;
-
-	motion_event = XInternAtom(dpy, "MotionEvent", True);
-	button_press_event = XInternAtom(dpy, "ButtonPressEvent", True);
-	button_release_event = XInternAtom(dpy, "ButtonReleaseEvent", True);
-	command_event = XInternAtom(dpy, "CommandEvent", True);
-
-	if(!motion_event || !button_press_event || !button_release_event || !command_event) {
-		dpy = 0;
-		return -1;	/* daemon not started */
+	if(strlen(dir) + 32 >= bufsz) {
+		return -1;
 	}
+	sprintf(buf, "%s/libspnav-proto", dir);
+	return 0;
+}
 
-	if(spnav_x11_window(win) == -1) {
-		dpy = 0;
-		return -1;	/* daemon not started */
-	}
+/* Identifies the daemon instance at the other end of the socket being opened.
+ * Returns -1 if there's no usable cache.
+ */
+static int proto_cache_key(struct spnav_ctx *ctx)
+{
+	struct stat st;
 
-	app_win = win;
+	if(stat(ctx->open_addr.sun_path, &st) == -1) {
+		return -1;
+	}
+	ctx->open_ino = st.st_ino;
+	ctx->open_ctime = st.st_ctime;
 	return 0;
 }
-#endif
 
-int spnav_close(void)
+/* Returns the cached protocol version for the daemon instance we're
+ * connecting to, or -1 if it's not in the cache.
+ */
+static int proto_cache_lookup(struct spnav_ctx *ctx)
 {
-	if(!IS_OPEN) {
+	FILE *fp;
+	char fname[512], line[512], *path;
+	int proto, n;
+	unsigned long ino;
+	long ctm;
+
+	if(proto_cache_file(fname, sizeof fname) == -1 || proto_cache_key(ctx) == -1) {
+		return -1;
+	}
+	if(!(fp = fopen(fname, "r"))) {
 		return -1;
 	}
 
-	if(sock) {
-		while(ev_queue) {
-			void *tmp = ev_queue;
-			ev_queue = ev_queue->next;
-			free(tmp);
+	while(fgets(line, sizeof line, fp)) {
+		if(sscanf(line, "%d %lu %ld %n", &proto, &ino, &ctm, &n) < 3) {
+			continue;
 		}
+		path = line + n;
+		path[strcspn(path, "\n")] = 0;
 
-		close(sock);
-		sock = -1;
-		return 0;
-	}
-
-#ifdef SPNAV_USE_X11
-	if(dpy) {
-		spnav_x11_window(DefaultRootWindow(dpy));
-		app_win = 0;
-		dpy = 0;
-		return 0;
+		if(strcmp(path, ctx->open_addr.sun_path) == 0) {
+			fclose(fp);
+			if(ino != ctx->open_ino || ctm != ctx->open_ctime) {
+				return -1;	/* different daemon instance */
+			}
+			return proto;
+		}
 	}
-#endif
-
+	fclose(fp);
 	return -1;
 }
 
-
-#ifdef SPNAV_USE_X11
-int spnav_x11_window(Window win)
+/* Records the negotiated protocol version for the daemon we just connected
+ * to. The cache file is rewritten and renamed into place, so that concurrent
+ * readers never see a partially written file.
+ */
+static void proto_cache_store(struct spnav_ctx *ctx, int proto)
 {
-	int (*prev_xerr_handler)(Display*, XErrorEvent*);
-	XEvent xev;
-	Window daemon_win;
+	FILE *fp, *tmpfp;
+	char fname[512], tmpname[600], line[512];
+	int n, count = 1;
+	size_t len;
+	char *path;
 
-	if(!IS_OPEN) {
-		return -1;
+	if(proto_cache_file(fname, sizeof fname) == -1) {
+		return;
 	}
-
-	if(!(daemon_win = get_daemon_window(dpy))) {
-		return -1;
+	sprintf(tmpname, "%s.%ld", fname, (long)getpid());
+	if(!(tmpfp = fopen(tmpname, "w"))) {
+		return;
+	}
+	fprintf(tmpfp, "%d %lu %ld %s\n", proto, ctx->open_ino, ctx->open_ctime,
+			ctx->open_addr.sun_path);
+
+	/* keep the entries for other sockets */
+	if((fp = fopen(fname, "r"))) {
+		while(count < PROTO_CACHE_MAX && fgets(line, sizeof line, fp)) {
+			n = 0;
+			sscanf(line, "%*d %*u %*d %n", &n);
+			if(!n) continue;
+			path = line + n;
+			len = strcspn(path, "\n");
+			if(len == strlen(ctx->open_addr.sun_path) &&
+					memcmp(path, ctx->open_addr.sun_path, len) == 0) {
+				continue;
+			}
+			fputs(line, tmpfp);
+			count++;
+		}
+		fclose(fp);
 	}
 
-	prev_xerr_handler = XSetErrorHandler(catch_badwin);
+	if(fclose(tmpfp) != 0 || rename(tmpname, fname) == -1) {
+		remove(tmpname);
+	}
+}
 
-	xev.type = ClientMessage;
-	xev.xclient.send_event = False;
-	xev.xclient.display = dpy;
-	xev.xclient.window = win;
-	xev.xclient.message_type = command_event;
-	xev.xclient.format = 16;
-	xev.xclient.data.s[0] = ((unsigned int)win & 0xffff0000) >> 16;
-	xev.xclient.data.s[1] = (unsigned int)win & 0xffff;
-	xev.xclient.data.s[2] = CMD_APP_WINDOW;
+/* Reads handshake data from the daemon into the receive buffer, without
+ * blocking. If the daemon passes a file descriptor along with it (the shared
+ * memory event ring), it's kept in open_shmfd.
+ */
+static int open_recv(struct spnav_ctx *ctx, int s)
+{
+	int rd;
+#ifdef SPNAV_USE_SHM
+	int fd;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} cbuf;
+
+	iov.iov_base = (char*)ctx->rxbuf + ctx->rx_end;
+	iov.iov_len = sizeof ctx->rxbuf - ctx->rx_end;
+	memset(&msg, 0, sizeof msg);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf.buf;
+	msg.msg_controllen = sizeof cbuf.buf;
 
-	XSendEvent(dpy, daemon_win, False, 0, &xev);
-	XSync(dpy, False);
+	do {
+		rd = recvmsg(s, &msg, MSG_DONTWAIT);
+	} while(rd == -1 && errno == EINTR);
 
-	XSetErrorHandler(prev_xerr_handler);
-	return 0;
+	if(rd > 0) {
+		for(cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+				continue;
+			}
+			memcpy(&fd, CMSG_DATA(cmsg), sizeof fd);
+			if(ctx->open_shmfd != -1) {
+				close(ctx->open_shmfd);
+			}
+			ctx->open_shmfd = fd;
+		}
+	}
+#else
+	do {
+		rd = recv(s, (char*)ctx->rxbuf + ctx->rx_end, sizeof ctx->rxbuf - ctx->rx_end,
+				MSG_DONTWAIT);
+	} while(rd == -1 && errno == EINTR);
+#endif
+	return rd;
 }
 
-static int x11_sensitivity(double sens)
+#ifdef SPNAV_USE_SHM
+/* Maps the shared memory event ring received during the handshake */
+static int shm_map(struct spnav_ctx *ctx)
 {
-	int (*prev_xerr_handler)(Display*, XErrorEvent*);
-	XEvent xev;
-	Window daemon_win;
-	float fsens;
-	unsigned int isens;
+	struct stat st;
+	struct shm_ring *ring;
+	unsigned int size;
 
-	if(!(daemon_win = get_daemon_window(dpy))) {
+	if(fstat(ctx->open_shmfd, &st) == -1 || st.st_size < SHM_RING_BYTES(1)) {
+		return -1;
+	}
+	ring = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, ctx->open_shmfd, 0);
+	if(ring == MAP_FAILED) {
 		return -1;
 	}
 
-	fsens = sens;
-	isens = *(unsigned int*)&fsens;
-
-	prev_xerr_handler = XSetErrorHandler(catch_badwin);
-
-	xev.type = ClientMessage;
-	xev.xclient.send_event = False;
-	xev.xclient.display = dpy;
-	xev.xclient.window = app_win;
-	xev.xclient.message_type = command_event;
-	xev.xclient.format = 16;
-	xev.xclient.data.s[0] = isens & 0xffff;
-	xev.xclient.data.s[1] = (isens & 0xffff0000) >> 16;
-	xev.xclient.data.s[2] = CMD_APP_SENS;
-
-	XSendEvent(dpy, daemon_win, False, 0, &xev);
-	XSync(dpy, False);
+	size = ring->size;
+	if(ring->magic != SHM_RING_MAGIC || !size || (size & (size - 1)) ||
+			size > (st.st_size - SHM_RING_BYTES(0)) / sizeof *ring->ev) {
+		munmap(ring, st.st_size);
+		return -1;
+	}
 
-	XSetErrorHandler(prev_xerr_handler);
+	ctx->shm = ring;
+	ctx->shm_size = size;
+	ctx->shm_len = st.st_size;
 	return 0;
 }
 #endif
 
-int spnav_sensitivity(double sens)
+static void open_fail(struct spnav_ctx *ctx)
 {
-	float fval;
-	struct reqresp rr;
-
-#ifdef SPNAV_USE_X11
-	if(dpy) {
-		return x11_sensitivity(sens);
+	if(ctx->open_sock != -1) {
+		close(ctx->open_sock);
+		ctx->open_sock = -1;
+	}
+#ifdef SPNAV_USE_SHM
+	if(ctx->open_shmfd != -1) {
+		close(ctx->open_shmfd);
+		ctx->open_shmfd = -1;
 	}
 #endif
+	free(ctx->evq);
+	ctx->evq = 0;
+	ctx->open_state = OPEN_IDLE;
+}
 
-	fval = sens;
+/* Starts connecting to the next candidate daemon socket path. Returns 0 if
+ * the connection is in progress or established, -1 if there are no more paths
+ * to try.
+ */
+static int open_next_path(struct spnav_ctx *ctx)
+{
+	int s;
+	const char *path;
+	char buf[256];
 
-	if(proto == 0) {
-		if(sock) {
-			ssize_t bytes;
+	while((path = sock_path(ctx->open_path++, buf, sizeof buf))) {
+		if(!*path) continue;
 
-			while((bytes = write(sock, &fval, sizeof fval)) <= 0 && errno == EINTR);
-			if(bytes <= 0) {
-				return -1;
-			}
+		if((s = socket(PF_UNIX, SOCK_STREAM, 0)) == -1) {
+			break;
+		}
+		fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+
+		if(connect_afunix(s, &ctx->open_addr, path) == 0 || errno == EINPROGRESS ||
+				errno == EAGAIN) {
+			ctx->open_sock = s;
+			ctx->open_state = OPEN_CONNECTING;
 			return 0;
 		}
-		return -1;
+		close(s);
 	}
+	return -1;
+}
 
-	rr.data[0] = *(int*)&fval;
-	if(request(REQ_SET_SENS, &rr, TIMEOUT) == -1) {
+/* Allocates the event queue, and resets all per-connection state */
+static int open_init(struct spnav_ctx *ctx)
+{
+	if(!(ctx->evq = malloc(ctx->evq_size * sizeof *ctx->evq))) {
 		return -1;
 	}
+	ctx->evq_rd = ctx->evq_count = 0;
+	ctx->evq_dropped = 0;
+	ctx->last_ev_time.sec = ctx->last_ev_time.nsec = 0;
+	reset_state(ctx);
+	ctx->num_devs = ctx->sel_dev = ctx->devs_seeded = 0;
+	ctx->evmask = SPNAV_EVMASK_DEFAULT;
+	memset(&ctx->cfgc, 0, sizeof ctx->cfgc);
+	ctx->cfgc_state = 0;
+	ctx->cfgb_active = ctx->cfgb_count = 0;
+	ctx->rx_start = ctx->rx_end = 0;
+	ctx->respq_rd = ctx->respq_count = 0;
+	ctx->dinfo_state = ctx->dinfo_stale = 0;
+	memset(ctx->areq, 0, sizeof ctx->areq);
+	ctx->areq_live = 0;
+	ctx->proto = 0;
 	return 0;
 }
 
-int spnav_fd(void)
+static int open_start(struct spnav_ctx *ctx)
 {
-#ifdef SPNAV_USE_X11
-	if(dpy) {
-		return ConnectionNumber(dpy);
+	if(IS_OPEN(ctx) || ctx->open_state != OPEN_IDLE) {
+		return -1;
+	}
+	if(open_init(ctx) == -1) {
+		return -1;
 	}
-#endif
 
-	return sock;
+	ctx->open_sock = -1;
+	ctx->open_path = 0;
+	if(open_next_path(ctx) == -1) {
+		open_fail(ctx);
+		return -1;
+	}
+	return 0;
 }
 
-
-/* Checks both the event queue and the daemon socket for pending events.
- * In either case, it returns immediately with true/false values (doesn't block).
+/* Looks for the protocol change response in the receive buffer. It's normally
+ * the first thing the daemon sends, but it might follow any number of event
+ * packets, sent before the daemon got to our request. If it's found, it's
+ * removed from the buffer, leaving any events before and after it in place,
+ * and the negotiated version is stored in ctx->proto. Returns 0 if found, -1
+ * if not.
  */
-static int event_pending(int s)
+static int open_find_reply(struct spnav_ctx *ctx)
 {
-	fd_set rd_set;
-	struct timeval tv;
-
-	if(ev_queue->next) {
-		return 1;
-	}
-
-	FD_ZERO(&rd_set);
-	FD_SET(s, &rd_set);
-
-	/* don't block, just poll */
-	tv.tv_sec = tv.tv_usec = 0;
-
-	if(select(s + 1, &rd_set, 0, 0, &tv) > 0) {
-		return 1;
+	int pos;
+	int32_t cmd;
+	char *buf = (char*)ctx->rxbuf;
+
+	for(pos=0; pos + (int)sizeof cmd <= ctx->rx_end; pos += 8 * sizeof *ctx->rxbuf) {
+		memcpy(&cmd, buf + pos, sizeof cmd);
+		if((cmd & ~0xff) == (REQ_TAG | REQ_CHANGE_PROTO)) {
+			ctx->proto = cmd & 0xff;
+			ctx->rx_end -= sizeof cmd;
+			memmove(buf + pos, buf + pos + sizeof cmd, ctx->rx_end - pos);
+			return 0;
+		}
 	}
-	return 0;
+	return -1;
 }
 
-/* If there are events waiting in the event queue, dequeue one and
- * return that, otherwise read one from the daemon socket.
- * This might block unless we called event_pending() first and it returned true.
- */
-static int read_event(int s, spnav_event *event)
+/* Advances the open state machine (see spnav_open_continue) */
+static int open_continue(struct spnav_ctx *ctx, int *timeout_ms)
 {
-	int rd;
-	int32_t data[8];
+	int rd, cmd, s;
+	long msec;
+	struct spnav_timestamp now;
+
+	switch(ctx->open_state) {
+	case OPEN_CONNECTING:
+		s = ctx->open_sock;
+		if(connect_afunix(s, &ctx->open_addr, 0) == -1 && errno != EISCONN) {
+			if(errno == EINPROGRESS || errno == EALREADY) {
+				if(timeout_ms) *timeout_ms = OPEN_RETRY_MSEC;
+				return SPNAV_OPEN_WAIT_WRITE;
+			}
+			if(errno == EAGAIN) {
+				/* the listen backlog is full. The socket won't become writable
+				 * for this attempt, so just try connecting again in a while
+				 */
+				if(timeout_ms) *timeout_ms = OPEN_RETRY_MSEC;
+				return SPNAV_OPEN_WAIT_TIMEOUT;
+			}
+			/* this one failed, try the next path */
+			close(s);
+			ctx->open_sock = -1;
+			if(open_next_path(ctx) == -1) {
+				open_fail(ctx);
+				return -1;
+			}
+			return open_continue(ctx, timeout_ms);
+		}
 
-	/* if we have a queued event, deliver that one */
-	if(ev_queue->next) {
-		struct event_node *node = ev_queue->next;
-		ev_queue->next = ev_queue->next->next;
+		/* connected, back to blocking mode and start the protocol handshake */
+		fcntl(s, F_SETFL, fcntl(s, F_GETFL) & ~O_NONBLOCK);
 
-		/* dequeued the last event, must update tail pointer */
-		if(ev_queue_tail == node) {
-			ev_queue_tail = ev_queue;
+		/* if we already know that this daemon doesn't understand protocol
+		 * changes, don't bother asking
+		 */
+		if((ctx->open_cached = proto_cache_lookup(ctx)) == 0) {
+			ctx->proto = 0;
+			break;
 		}
 
-		memcpy(event, &node->event, sizeof *event);
-		free(node);
-		return event->type;
-	}
+		cmd = REQ_TAG | REQ_CHANGE_PROTO | CLIENT_PROTO_VER;
+		if(write(s, &cmd, sizeof cmd) != sizeof cmd) {
+			open_fail(ctx);
+			return -1;
+		}
+		get_time(&ctx->open_deadline);
+		ctx->open_deadline.nsec += OPEN_PROTO_TIMEOUT * 1000000;
+		ctx->open_deadline.sec += ctx->open_deadline.nsec / 1000000000;
+		ctx->open_deadline.nsec %= 1000000000;
+		ctx->open_state = OPEN_HANDSHAKE;
+		/* fallthrough */
+
+	case OPEN_HANDSHAKE:
+		s = ctx->open_sock;
+		rd = open_recv(ctx, s);
+
+		if(rd == 0 || (rd == -1 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+			open_fail(ctx);
+			return -1;
+		}
+		if(rd > 0) {
+			get_time(&ctx->rx_time);
+			ctx->rx_end += rd;
+		}
 
-	/* otherwise read one from the connection */
-	do {
-		rd = read(s, data, sizeof data);
-	} while(rd == -1 && errno == EINTR);
+		if(open_find_reply(ctx) == 0) {
+			break;
+		}
 
-	if(rd <= 0) {
+		/* A few events alone don't prove anything; a newer daemon might send
+		 * some before it gets to our request. Keep waiting for the response,
+		 * unless the receive buffer fills up with events first, which a newer
+		 * daemon answering right after we connected wouldn't do.
+		 */
+		get_time(&now);
+		msec = (ctx->open_deadline.sec - now.sec) * 1000 +
+			(ctx->open_deadline.nsec - now.nsec) / 1000000;
+		if(msec > 0 && ctx->rx_end < sizeof ctx->rxbuf) {
+			if(timeout_ms) *timeout_ms = msec;
+			return SPNAV_OPEN_WAIT_READ;
+		}
+
+		/* if we time out, assume we're talking with an old version of
+		 * spacenavd, which took our packet as a sensitivity value, so restore
+		 * sensitivity to 1.0 and continue with protocol v0. Cache the result,
+		 * so that the next open doesn't have to wait for the timeout again.
+		 */
+		ctx->proto = 0;
+		ctx->sock = ctx->open_sock;
+		ctx->open_sock = -1;
+		ctx->open_state = OPEN_IDLE;
+		spnav_ctx_sensitivity(ctx, 1.0f);
+		if(ctx->open_cached != 0) {
+			proto_cache_store(ctx, 0);
+		}
 		return 0;
-	}
 
-	return proc_event(data, event);
-}
+	default:
+		return IS_OPEN(ctx) ? 0 : -1;
+	}
 
-static int proc_event(int32_t *data, spnav_event *event)
-{
+#ifdef SPNAV_USE_SHM
+	if(ctx->open_shmfd != -1) {
+		/* the daemon is going to write events to the ring, we can't ignore it */
+		if(ctx->proto >= 2 && shm_map(ctx) == -1) {
+			open_fail(ctx);
+			return -1;
+		}
+		if(ctx->open_shmfd != -1) {
+			close(ctx->open_shmfd);
+			ctx->open_shmfd = -1;
+		}
+	}
+#endif
+
+	if(ctx->open_cached != ctx->proto) {
+		proto_cache_store(ctx, ctx->proto);
+	}
+	ctx->sock = ctx->open_sock;
+	ctx->open_sock = -1;
+	ctx->open_state = OPEN_IDLE;
+	if(ctx->proto >= 1) {
+		dev_prefetch(ctx);
+	}
+	return 0;
+}
+
+static int open_ctx(struct spnav_ctx *ctx)
+{
+	int res, tmo;
+	struct pollfd pfd;
+
+	if(open_start(ctx) == -1) {
+		return -1;
+	}
+
+	while((res = open_continue(ctx, &tmo)) > 0) {
+		/* a negative fd makes poll just wait for the timeout */
+		pfd.fd = res == SPNAV_OPEN_WAIT_TIMEOUT ? -1 : ctx->open_sock;
+		pfd.events = res == SPNAV_OPEN_WAIT_READ ? POLLIN : POLLOUT;
+		while(poll(&pfd, 1, tmo) == -1 && errno == EINTR);
+	}
+	return res;
+}
+
+int spnav_ctx_open_continue(spnav_ctx *ctx, int *timeout_ms)
+{
+	return open_continue(ctx, timeout_ms);
+}
+
+spnav_ctx *spnav_ctx_open_async(void)
+{
+	struct spnav_ctx *ctx;
+
+	if(!(ctx = malloc(sizeof *ctx))) {
+		return 0;
+	}
+	init_ctx(ctx);
+
+	if(open_start(ctx) == -1) {
+		destroy_ctx(ctx);
+		return 0;
+	}
+	return ctx;
+}
+
+spnav_ctx *spnav_ctx_open(void)
+{
+	struct spnav_ctx *ctx;
+
+	if(!(ctx = malloc(sizeof *ctx))) {
+		return 0;
+	}
+	init_ctx(ctx);
+
+	if(open_ctx(ctx) == -1) {
+		destroy_ctx(ctx);
+		return 0;
+	}
+	return ctx;
+}
+
+#ifdef SPNAV_USE_X11
+static int x11_open_ctx(struct spnav_ctx *ctx, Display *display, Window win)
+{
+	if(IS_OPEN(ctx)) {
+		return -1;
+	}
+
+	ctx->dpy = display;
+	reset_state(ctx);
+
+	ctx->motion_event = XInternAtom(ctx->dpy, "MotionEvent", True);
+	ctx->button_press_event = XInternAtom(ctx->dpy, "ButtonPressEvent", True);
+	ctx->button_release_event = XInternAtom(ctx->dpy, "ButtonReleaseEvent", True);
+	ctx->command_event = XInternAtom(ctx->dpy, "CommandEvent", True);
+
+	if(!ctx->motion_event || !ctx->button_press_event || !ctx->button_release_event || !ctx->command_event) {
+		ctx->dpy = 0;
+		return -1;	/* daemon not started */
+	}
+
+	if(spnav_ctx_x11_window(ctx, win) == -1) {
+		ctx->dpy = 0;
+		return -1;	/* daemon not started */
+	}
+
+	ctx->app_win = win;
+	return 0;
+}
+
+spnav_ctx *spnav_ctx_x11_open(Display *dpy, Window win)
+{
+	struct spnav_ctx *ctx;
+
+	if(!(ctx = malloc(sizeof *ctx))) {
+		return 0;
+	}
+	init_ctx(ctx);
+
+	if(x11_open_ctx(ctx, dpy, win) == -1) {
+		destroy_ctx(ctx);
+		return 0;
+	}
+	return ctx;
+}
+#endif
+
+static int close_ctx(struct spnav_ctx *ctx)
+{
+	if(ctx->open_state != OPEN_IDLE) {
+		open_fail(ctx);		/* abort asynchronous open */
+		return 0;
+	}
+	if(!IS_OPEN(ctx)) {
+		return -1;
+	}
+
+	if(ctx->sock != -1) {
+#ifdef SPNAV_USE_THREADS
+		thr_stop(ctx);
+#endif
+		rec_stop(ctx);
+		free(ctx->evq);
+		ctx->evq = 0;
+		ctx->evq_count = 0;
+		dev_free_info(ctx);
+		ctx->dinfo_state = DINFO_NONE;
+		free(ctx->cfgb);
+		ctx->cfgb = 0;
+		ctx->cfgb_size = 0;
+#ifdef SPNAV_USE_SHM
+		if(ctx->shm) {
+			munmap(ctx->shm, ctx->shm_len);
+			ctx->shm = 0;
+		}
+#endif
+		if(ctx->rp_data) {
+			munmap((void*)ctx->rp_data, ctx->rp_size);
+			ctx->rp_data = 0;
+		}
+
+		close(ctx->sock);
+		ctx->sock = -1;
+		return 0;
+	}
+
+#ifdef SPNAV_USE_X11
+	if(ctx->dpy) {
+		spnav_ctx_x11_window(ctx, DefaultRootWindow(ctx->dpy));
+		ctx->app_win = 0;
+		ctx->dpy = 0;
+		return 0;
+	}
+#endif
+
+	return -1;
+}
+
+int spnav_ctx_close(spnav_ctx *ctx)
+{
+	int res;
+
+	if(!ctx) {
+		return -1;
+	}
+	res = close_ctx(ctx);
+
+	if(ctx != &defctx) {
+		destroy_ctx(ctx);
+	}
+	return res;
+}
+
+spnav_ctx *spnav_default_ctx(void)
+{
+	return get_defctx();
+}
+
+
+#ifdef SPNAV_USE_X11
+int spnav_ctx_x11_window(spnav_ctx *ctx, Window win)
+{
+	int (*prev_xerr_handler)(Display*, XErrorEvent*);
+	XEvent xev;
+	Window daemon_win;
+
+	if(!IS_OPEN(ctx)) {
+		return -1;
+	}
+
+	if(!(daemon_win = get_daemon_window(ctx))) {
+		return -1;
+	}
+
+	prev_xerr_handler = XSetErrorHandler(catch_badwin);
+
+	xev.type = ClientMessage;
+	xev.xclient.send_event = False;
+	xev.xclient.display = ctx->dpy;
+	xev.xclient.window = win;
+	xev.xclient.message_type = ctx->command_event;
+	xev.xclient.format = 16;
+	xev.xclient.data.s[0] = ((unsigned int)win & 0xffff0000) >> 16;
+	xev.xclient.data.s[1] = (unsigned int)win & 0xffff;
+	xev.xclient.data.s[2] = CMD_APP_WINDOW;
+
+	XSendEvent(ctx->dpy, daemon_win, False, 0, &xev);
+	XSync(ctx->dpy, False);
+
+	XSetErrorHandler(prev_xerr_handler);
+	return 0;
+}
+
+static int x11_sensitivity(struct spnav_ctx *ctx, double sens)
+{
+	int (*prev_xerr_handler)(Display*, XErrorEvent*);
+	XEvent xev;
+	Window daemon_win;
+	float fsens;
+	unsigned int isens;
+
+	if(!(daemon_win = get_daemon_window(ctx))) {
+		return -1;
+	}
+
+	fsens = sens;
+	isens = *(unsigned int*)&fsens;
+
+	prev_xerr_handler = XSetErrorHandler(catch_badwin);
+
+	xev.type = ClientMessage;
+	xev.xclient.send_event = False;
+	xev.xclient.display = ctx->dpy;
+	xev.xclient.window = ctx->app_win;
+	xev.xclient.message_type = ctx->command_event;
+	xev.xclient.format = 16;
+	xev.xclient.data.s[0] = isens & 0xffff;
+	xev.xclient.data.s[1] = (isens & 0xffff0000) >> 16;
+	xev.xclient.data.s[2] = CMD_APP_SENS;
+
+	XSendEvent(ctx->dpy, daemon_win, False, 0, &xev);
+	XSync(ctx->dpy, False);
+
+	XSetErrorHandler(prev_xerr_handler);
+	return 0;
+}
+#endif
+
+int spnav_ctx_sensitivity(spnav_ctx *ctx, double sens)
+{
+	float fval;
+	struct reqresp rr;
+
+#ifdef SPNAV_USE_X11
+	if(ctx->dpy) {
+		return x11_sensitivity(ctx, sens);
+	}
+#endif
+
+	fval = sens;
+
+	if(ctx->proto == 0) {
+		if(ctx->sock) {
+			ssize_t bytes;
+
+			while((bytes = write(ctx->sock, &fval, sizeof fval)) <= 0 && errno == EINTR);
+			if(bytes <= 0) {
+				return -1;
+			}
+			return 0;
+		}
+		return -1;
+	}
+
+	rr.data[0] = *(int*)&fval;
+	if(request(ctx, REQ_SET_SENS, &rr, TIMEOUT) == -1) {
+		return -1;
+	}
+	return 0;
+}
+
+int spnav_ctx_fd(spnav_ctx *ctx)
+{
+#ifdef SPNAV_USE_X11
+	if(ctx->dpy) {
+		return ConnectionNumber(ctx->dpy);
+	}
+#endif
+#ifdef SPNAV_USE_THREADS
+	if(ctx->thr_running) {
+		return ctx->thr_wakepipe[0];
+	}
+#endif
+	if(ctx->open_state != OPEN_IDLE) {
+		return ctx->open_sock;
+	}
+
+	return ctx->sock;
+}
+
+
+#ifdef SPNAV_USE_SHM
+/* Copies as many events as fit in the receive buffer from the shared memory
+ * ring, and returns the number of bytes copied. The ring is checked once more
+ * after updating rd, even if it looked empty, before the caller goes on to
+ * wait on the socket (see proto.h).
+ */
+static int shm_pull(struct spnav_ctx *ctx)
+{
+	struct shm_ring *ring = ctx->shm;
+	unsigned int rd, count, max, idx, n;
+	char *dest;
+
+	rd = ring->rd;
+	if(!(count = ATOMIC_LOAD(ring->wr) - rd)) {
+		return 0;
+	}
+	if(count > ctx->shm_size) {
+		count = ctx->shm_size;	/* broken daemon, don't read past the ring */
+	}
+	max = (sizeof ctx->rxbuf - ctx->rx_end) / sizeof *ring->ev;
+	if(count > max) {
+		count = max;
+	}
+
+	/* at most two contiguous spans, if it wraps around the end of the ring */
+	dest = (char*)ctx->rxbuf + ctx->rx_end;
+	idx = rd & (ctx->shm_size - 1);
+	n = ctx->shm_size - idx;
+	if(n > count) n = count;
+	memcpy(dest, ring->ev + idx, n * sizeof *ring->ev);
+	if(n < count) {
+		memcpy(dest + n * sizeof *ring->ev, ring->ev, (count - n) * sizeof *ring->ev);
+	}
+	ATOMIC_STORE(ring->rd, rd + count);
+
+	get_time(&ctx->rx_time);
+	ctx->rx_end += count * sizeof *ring->ev;
+	return count * sizeof *ring->ev;
+}
+#endif
+
+/* Reads whatever is available on the daemon socket into the receive buffer,
+ * with a single recv call. If block is non-zero, waits until some data arrives.
+ * Returns the number of bytes read, 0 if nothing was pending (non-blocking), or
+ * -1 on error or if the connection was closed.
+ *
+ * With the shared memory transport, events are taken from the ring without
+ * touching the socket, which is only read if the ring is empty, or if resp is
+ * non-zero, because the caller is waiting for request responses.
+ */
+static int rx_fill(struct spnav_ctx *ctx, int block, int resp)
+{
+	int rd, got = 0;
+
+	/* move any leftover partial packet to the start of the buffer */
+	if(ctx->rx_start > 0) {
+		if(ctx->rx_end > ctx->rx_start) {
+			memmove(ctx->rxbuf, (char*)ctx->rxbuf + ctx->rx_start, ctx->rx_end - ctx->rx_start);
+		}
+		ctx->rx_end -= ctx->rx_start;
+		ctx->rx_start = 0;
+	}
+	if(ctx->rx_end >= sizeof ctx->rxbuf) {
+		return 0;
+	}
+
+	if(IS_REPLAY(ctx)) {
+		return resp ? 0 : replay_fill(ctx, block);
+	}
+
+#ifdef SPNAV_USE_SHM
+	/* a partial packet at the end of the buffer must be completed from the
+	 * socket first
+	 */
+	if(ctx->shm && !(ctx->rx_end & (sizeof *ctx->shm->ev - 1))) {
+		if((got = shm_pull(ctx)) > 0) {
+			if(!resp || ctx->rx_end >= sizeof ctx->rxbuf) {
+				return got;
+			}
+			block = 0;
+		}
+	}
+#endif
+
+	do {
+		rd = recv(ctx->sock, (char*)ctx->rxbuf + ctx->rx_end, sizeof ctx->rxbuf - ctx->rx_end,
+				block ? 0 : MSG_DONTWAIT);
+	} while(rd == -1 && errno == EINTR);
+
+	if(rd <= 0) {
+		if(rd == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return got;
+		}
+		return -1;
+	}
+
+	get_time(&ctx->rx_time);
+	ctx->rx_end += rd;
+	return got + rd;
+}
+
+/* Returns non-zero if there might be events pending which haven't been read
+ * yet. With the shared memory transport, events only go through the ring, so
+ * this doesn't need a system call. Otherwise the socket is polled.
+ */
+static int rx_pending(struct spnav_ctx *ctx)
+{
+	struct pollfd pfd;
+
+#ifdef SPNAV_USE_SHM
+	if(ctx->shm) {
+		return SHM_PENDING(ctx);
+	}
+#endif
+	pfd.fd = ctx->sock;
+	pfd.events = POLLIN;
+	return poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN);
+}
+
+/* Returns a pointer to the next complete packet in the receive buffer, and
+ * consumes it, or a null pointer if there isn't a whole packet buffered yet.
+ */
+static int32_t *rx_packet(struct spnav_ctx *ctx)
+{
+	int32_t *pkt;
+
+	if(ctx->rx_end - ctx->rx_start < 8 * sizeof *ctx->rxbuf) {
+		return 0;
+	}
+	pkt = (int32_t*)((char*)ctx->rxbuf + ctx->rx_start);
+	ctx->rx_start += 8 * sizeof *ctx->rxbuf;
+	return pkt;
+}
+
+/* Keeps a request response found while reading events, for wait_resp. These
+ * are normally late responses nobody is waiting for, except for the responses
+ * to the device descriptor requests sent at open (see dev_prefetch).
+ */
+static void stash_resp(struct spnav_ctx *ctx, const int32_t *pkt)
+{
+	if(ctx->respq_count >= RESPQ_SIZE) {
+		/* drop the oldest one */
+		ctx->respq_rd = (ctx->respq_rd + 1) % RESPQ_SIZE;
+		ctx->respq_count--;
+	}
+	memcpy(ctx->respq + (ctx->respq_rd + ctx->respq_count++) % RESPQ_SIZE, pkt,
+			sizeof *ctx->respq);
+}
+
+/* Handles a request response found while reading events. Responses to
+ * asynchronous requests are turned into completion events in the event queue,
+ * and the rest are stashed for wait_resp.
+ */
+static void proc_resp(struct spnav_ctx *ctx, const int32_t *pkt)
+{
+	spnav_event ev;
+
+	if(async_resp(ctx, pkt, &ev)) {
+		if(ev.type) {
+			enqueue_event(ctx, &ev, &ctx->rx_time);
+		}
+		return;
+	}
+	stash_resp(ctx, pkt);
+}
+
+/* If there are events waiting in the event queue, dequeue one and
+ * return that, otherwise read one from the daemon socket.
+ * If block is zero, returns 0 immediately if there are no pending events.
+ */
+static int read_event(struct spnav_ctx *ctx, spnav_event *event, int block)
+{
+	int res, blk;
+
+	for(;;) {
+		/* don't block past any asynchronous request deadlines */
+		blk = async_wait(ctx, block);
+
+		/* when coalescing, everything pending goes through the queue, where
+		 * consecutive motion events are merged
+		 */
+		if(ctx->coalesce) {
+			queue_pending(ctx, blk);
+		}
+
+		if(ctx->evq_count) {
+			/* if we have a queued event, deliver that one */
+			dequeue_event(ctx, event, &ctx->last_ev_time);
+
+		} else if((res = read_events(ctx, event, &ctx->last_ev_time, 1, blk)) <= 0) {
+			/* otherwise read one from the connection. Nothing might have
+			 * been read if a request completion was queued instead.
+			 */
+			if(!ctx->evq_count && (res == -1 || !block)) {
+				return 0;
+			}
+			continue;
+		}
+
+		if(event->type == SPNAV_EVENT_REQ && async_filter(ctx, event, 0, 1) == 0) {
+			continue;	/* handled by a callback */
+		}
+		return event->type;
+	}
+}
+
+/* Decodes up to max events from the receive buffer into evbuf. If the buffer
+ * doesn't hold any complete packets, reads as many as are available from the
+ * daemon socket with a single recv call first. If block is non-zero, waits
+ * until at least one event arrives, otherwise returns 0 if nothing is pending.
+ * If tsbuf is not null, the receive time of each event is written to it.
+ * Returns the number of events written to evbuf, or -1 on error.
+ */
+static int read_events(struct spnav_ctx *ctx, spnav_event *evbuf, struct spnav_timestamp *tsbuf,
+		int max, int block)
+{
+	int res, count = 0;
+	int32_t *pkt;
+
+#ifdef SPNAV_USE_THREADS
+	if(ctx->thr_running) {
+		return thr_read_events(ctx, evbuf, tsbuf, max, block);
+	}
+#endif
+
+	for(;;) {
+		while(count < max && (pkt = rx_packet(ctx))) {
+			if((pkt[0] & 0xffff0000) == REQ_TAG) {
+				proc_resp(ctx, pkt);
+				continue;
+			}
+			if(proc_event(ctx, pkt, evbuf + count) > 0) {
+				if(tsbuf) {
+					tsbuf[count] = ctx->rx_time;
+				}
+				count++;
+			}
+		}
+		/* also stop if a request completion was queued */
+		if(count || ctx->evq_count) break;
+
+		if((res = rx_fill(ctx, block, 0)) <= 0) {
+			return res;
+		}
+	}
+	return count;
+}
+
+/* Decodes all complete packets in the receive buffer into the event queue */
+static void queue_packets(struct spnav_ctx *ctx)
+{
+	int32_t *pkt;
+	spnav_event ev;
+
+	while((pkt = rx_packet(ctx))) {
+		if((pkt[0] & 0xffff0000) == REQ_TAG) {
+			proc_resp(ctx, pkt);
+			continue;
+		}
+		if(proc_event(ctx, pkt, &ev) > 0) {
+			enqueue_event(ctx, &ev, &ctx->rx_time);
+		}
+	}
+}
+
+/* Reads all events pending on the daemon socket into the event queue. If block
+ * is non-zero and the queue is empty, waits until at least one event arrives.
+ * Returns the number of queued events, or -1 on error.
+ */
+static int queue_pending(struct spnav_ctx *ctx, int block)
+{
+	int res, space;
+
+#ifdef SPNAV_USE_THREADS
+	if(ctx->thr_running) {
+		int i;
+		spnav_event evbuf[32];
+		struct spnav_timestamp tsbuf[32];
+
+		do {
+			if((res = thr_read_events(ctx, evbuf, tsbuf, 32, block && !ctx->evq_count)) == -1) {
+				return -1;
+			}
+			for(i=0; i<res; i++) {
+				enqueue_event(ctx, evbuf + i, tsbuf + i);
+			}
+		} while(res == 32);
+		return ctx->evq_count;
+	}
+#endif
+
+	do {
+		queue_packets(ctx);
+		space = sizeof ctx->rxbuf - (ctx->rx_end - ctx->rx_start);
+		if((res = rx_fill(ctx, block && !ctx->evq_count, 0)) == -1) {
+			return -1;
+		}
+		queue_packets(ctx);
+		/* a read which didn't fill the buffer means we've drained the socket.
+		 * A replayed log has nothing to drain, and one batch is enough.
+		 */
+	} while((res == space && !IS_REPLAY(ctx)) || (block && !ctx->evq_count));
+
+	return ctx->evq_count;
+}
+
+static int proc_event(struct spnav_ctx *ctx, int32_t *data, spnav_event *event)
+{
+	int i;
+
+	if(data[0] < 0 || data[0] >= MAX_UEV) {
+		return 0;
+	}
+
+	switch(data[0]) {
+	case UEV_MOTION:
+		event->type = SPNAV_EVENT_MOTION;
+		break;
+	case UEV_PRESS:
+	case UEV_RELEASE:
+		event->type = SPNAV_EVENT_BUTTON;
+		break;
+	default:
+		event->type = data[0];
+	}
+
+	switch(event->type) {
+	case SPNAV_EVENT_MOTION:
+		event->motion.data = &event->motion.x;
+		for(i=0; i<6; i++) {
+			event->motion.data[i] = data[i + 1];
+		}
+		event->motion.period = data[7];
+		break;
+
+	case SPNAV_EVENT_RAWAXIS:
+		event->axis.idx = data[1];
+		event->axis.value = data[2];
+		break;
+
+	case SPNAV_EVENT_BUTTON:
+		event->button.press = data[0] == UEV_PRESS ? 1 : 0;
+		event->button.bnum = data[1];
+		break;
+
+	case SPNAV_EVENT_RAWBUTTON:
+		event->button.bnum = data[1];
+		event->button.press = data[2];
+		break;
+
+	case SPNAV_EVENT_DEV:
+		event->dev.op = data[1];
+		event->dev.id = data[2];
+		event->dev.devtype = data[3];
+		event->dev.usbid[0] = data[4];
+		event->dev.usbid[1] = data[5];
+		track_device(ctx, &event->dev);
+		break;
+
+	case SPNAV_EVENT_CFG:
+		event->cfg.cfg = data[1];
+		memcpy(event->cfg.data, data + 2, sizeof event->cfg.data);
+		cfg_cache_event(ctx, &event->cfg);
+		/* we might have enabled these just for the config cache */
+		if(!(ATOMIC_LOAD(ctx->evmask) & SPNAV_EVMASK_CFG)) {
+			return 0;
+		}
+		break;
+	}
+
+	if(ATOMIC_LOAD_RLX(ctx->rec_fp)) {
+		rec_event(ctx, data);
+	}
+	update_state(ctx, event, &ctx->rx_time);
+	return event->type;
+}
+
+
+int spnav_ctx_wait_event(spnav_ctx *ctx, spnav_event *event)
+{
+#ifdef SPNAV_USE_X11
+	if(ctx->dpy) {
+		for(;;) {
+			XEvent xev;
+			XNextEvent(ctx->dpy, &xev);
+
+			if(spnav_ctx_x11_event(ctx, &xev, event) > 0) {
+				return event->type;
+			}
+		}
+	}
+#endif
+
+	if(ctx->sock != -1) {
+		if(read_event(ctx, event, 1) > 0) {
+			return event->type;
+		}
+	}
+	return 0;
+}
+
+int spnav_ctx_poll_event(spnav_ctx *ctx, spnav_event *event)
+{
+#ifdef SPNAV_USE_X11
+	if(ctx->dpy) {
+		if(XPending(ctx->dpy)) {
+			XEvent xev;
+			XNextEvent(ctx->dpy, &xev);
+
+			return spnav_ctx_x11_event(ctx, &xev, event);
+		}
+		return 0;
+	}
+#endif
+
+	if(ctx->sock != -1) {
+		if(read_event(ctx, event, 0) > 0) {
+			return event->type;
+		}
+	}
+	return 0;
+}
+
+static int get_events(struct spnav_ctx *ctx, spnav_event *evbuf, struct spnav_timestamp *tsbuf,
+		int max, int block)
+{
+	int res, blk, count = 0;
+
+	if(max <= 0) {
+		return 0;
+	}
+
+#ifdef SPNAV_USE_X11
+	if(ctx->dpy) {
+		XEvent xev;
+
+		while(count < max && (XPending(ctx->dpy) || (block && !count))) {
+			XNextEvent(ctx->dpy, &xev);
+			if(spnav_ctx_x11_event(ctx, &xev, evbuf + count) > 0) {
+				if(tsbuf) {
+					get_time(tsbuf + count);
+				}
+				count++;
+			}
+		}
+		return count;
+	}
+#endif
+
+	if(ctx->sock == -1) {
+		return 0;
+	}
+
+	for(;;) {
+		/* don't block past any asynchronous request deadlines */
+		blk = async_wait(ctx, block);
+
+		if(ctx->coalesce) {
+			queue_pending(ctx, blk);
+		}
+
+		/* deliver any events left in the queue first */
+		while(count < max && ctx->evq_count) {
+			dequeue_event(ctx, evbuf + count, tsbuf ? tsbuf + count : 0);
+			count++;
+		}
+
+		res = 0;
+		if(count < max) {
+			if((res = read_events(ctx, evbuf + count, tsbuf ? tsbuf + count : 0,
+							max - count, blk && !count)) > 0) {
+				count += res;
+			}
+		}
+		/* request completions might have been queued while reading */
+		while(count < max && ctx->evq_count) {
+			dequeue_event(ctx, evbuf + count, tsbuf ? tsbuf + count : 0);
+			count++;
+		}
+
+		count = async_filter(ctx, evbuf, tsbuf, count);
+		if(count || !block || res == -1) {
+			return count;
+		}
+	}
+}
+
+int spnav_ctx_wait_events(spnav_ctx *ctx, spnav_event *evbuf, int max)
+{
+	return get_events(ctx, evbuf, 0, max, 1);
+}
+
+int spnav_ctx_poll_events(spnav_ctx *ctx, spnav_event *evbuf, int max)
+{
+	return get_events(ctx, evbuf, 0, max, 0);
+}
+
+int spnav_ctx_wait_events_ts(spnav_ctx *ctx, spnav_event *evbuf, struct spnav_timestamp *tsbuf, int max)
+{
+	return get_events(ctx, evbuf, tsbuf, max, 1);
+}
+
+int spnav_ctx_poll_events_ts(spnav_ctx *ctx, spnav_event *evbuf, struct spnav_timestamp *tsbuf, int max)
+{
+	return get_events(ctx, evbuf, tsbuf, max, 0);
+}
+
+int spnav_ctx_event_time(spnav_ctx *ctx, struct spnav_timestamp *ts)
+{
+	if(!ctx->last_ev_time.sec && !ctx->last_ev_time.nsec) {
+		return -1;
+	}
+	*ts = ctx->last_ev_time;
+	return 0;
+}
+
+#ifdef SPNAV_USE_X11
+struct match_arg {
+	struct spnav_ctx *ctx;
+	int evtype;
+};
+
+static Bool match_events(Display *dpy, XEvent *xev, char *arg)
+{
+	struct spnav_ctx *ctx = ((struct match_arg*)arg)->ctx;
+	int evtype = ((struct match_arg*)arg)->evtype;
+
+	if(xev->type != ClientMessage) {
+		return False;
+	}
+
+	if(xev->xclient.message_type == ctx->motion_event) {
+		return !evtype || evtype == SPNAV_EVENT_MOTION ? True : False;
+	}
+	if(xev->xclient.message_type == ctx->button_press_event ||
+			xev->xclient.message_type == ctx->button_release_event) {
+		return !evtype || evtype == SPNAV_EVENT_BUTTON ? True : False;
+	}
+	return False;
+}
+#endif
+
+/* Removes the queued event at position idx (0 is the oldest), shifting any
+ * newer events back to fill the gap.
+ */
+static void remove_queued(struct spnav_ctx *ctx, int idx)
+{
+	int i;
+
+	if(idx == 0) {
+		ctx->evq_rd = (ctx->evq_rd + 1) % ctx->evq_size;
+	} else {
+		for(i=idx; i<ctx->evq_count - 1; i++) {
+			ctx->evq[(ctx->evq_rd + i) % ctx->evq_size] = ctx->evq[(ctx->evq_rd + i + 1) % ctx->evq_size];
+		}
+	}
+	ctx->evq_count--;
+}
+
+/* Merges motion event src into dst, according to the coalescing mode */
+static void merge_motion(struct spnav_ctx *ctx, struct spnav_event_motion *dst,
+		const struct spnav_event_motion *src)
+{
+	int i;
+	long wdst, wsrc;
+	int *vdst = &dst->x;
+	const int *vsrc = &src->x;
+
+	switch(ctx->coalesce) {
+	case SPNAV_COALESCE_LATEST:
+		for(i=0; i<6; i++) {
+			vdst[i] = vsrc[i];
+		}
+		break;
+
+	case SPNAV_COALESCE_WEIGHTED:
+		/* period-weighted average, so that value * period of the merged event
+		 * is the sum of value * period of all the events it replaces. Events
+		 * without a period (v0 daemons, or the first event after open) carry no
+		 * weight; if neither has a period, the latest values are kept.
+		 */
+		wdst = dst->period;
+		wsrc = src->period;
+		for(i=0; i<6; i++) {
+			if(wdst + wsrc > 0) {
+				vdst[i] = (vdst[i] * wdst + vsrc[i] * wsrc) / (wdst + wsrc);
+			} else {
+				vdst[i] = vsrc[i];
+			}
+		}
+		break;
+	}
+	dst->period += src->period;
+}
+
+/* Appends an event to the event queue. If the queue is full, the oldest motion
+ * event is dropped to make room, or the oldest event if there are no motion
+ * events in the queue. Dropped events are counted in evq_dropped.
+ * In coalescing mode, a motion event following another motion event at the
+ * end of the queue is merged with it, and the merged event takes the receive
+ * time of the latest one.
+ */
+static void enqueue_event(struct spnav_ctx *ctx, const spnav_event *event, const struct spnav_timestamp *ts)
+{
+	int i, drop = 0;
+	struct queued_event *tail;
+
+	if(ctx->coalesce && ctx->evq_count && event->type == SPNAV_EVENT_MOTION) {
+		tail = ctx->evq + (ctx->evq_rd + ctx->evq_count - 1) % ctx->evq_size;
+		if(tail->ev.type == SPNAV_EVENT_MOTION) {
+			merge_motion(ctx, &tail->ev.motion, &event->motion);
+			tail->ts = *ts;
+			return;
+		}
+	}
+
+	if(ctx->evq_count >= ctx->evq_size) {
+		for(i=0; i<ctx->evq_count; i++) {
+			if(ctx->evq[(ctx->evq_rd + i) % ctx->evq_size].ev.type == SPNAV_EVENT_MOTION) {
+				drop = i;
+				break;
+			}
+		}
+		if(ctx->evq[(ctx->evq_rd + drop) % ctx->evq_size].ev.type == SPNAV_EVENT_REQ) {
+			async_take(ctx, ctx->evq[(ctx->evq_rd + drop) % ctx->evq_size].ev.req.token, 0, 0);
+		}
+		remove_queued(ctx, drop);
+		ctx->evq_dropped++;
+	}
+
+	tail = ctx->evq + (ctx->evq_rd + ctx->evq_count++) % ctx->evq_size;
+	tail->ev = *event;
+	tail->ts = *ts;
+}
+
+/* Removes the oldest event from the queue, and writes its receive time through
+ * ts, if it's not null. The queue must not be empty.
+ */
+static void dequeue_event(struct spnav_ctx *ctx, spnav_event *event, struct spnav_timestamp *ts)
+{
+	*event = ctx->evq[ctx->evq_rd].ev;
+	if(ts) {
+		*ts = ctx->evq[ctx->evq_rd].ts;
+	}
+	ctx->evq_rd = (ctx->evq_rd + 1) % ctx->evq_size;
+	ctx->evq_count--;
+
+	if(event->type == SPNAV_EVENT_MOTION) {
+		event->motion.data = &event->motion.x;
+	}
+}
+
+int spnav_ctx_remove_events(spnav_ctx *ctx, int type)
+{
+	int i, n, rm_count = 0;
+
+#ifdef SPNAV_USE_X11
+	if(ctx->dpy) {
+		XEvent xev;
+		struct match_arg marg;
+
+		marg.ctx = ctx;
+		marg.evtype = type;
+		while(XCheckIfEvent(ctx->dpy, &xev, match_events, (char*)&marg)) {
+			rm_count++;
+		}
+		return rm_count;
+	}
+#endif
+
+	if(ctx->sock != -1) {
+		spnav_event evbuf[32];
+		struct spnav_timestamp tsbuf[32];
+
+		/* compact the queue in place, dropping events of the requested type */
+		n = 0;
+		for(i=0; i<ctx->evq_count; i++) {
+			struct queued_event *qev = ctx->evq + (ctx->evq_rd + i) % ctx->evq_size;
+			if(type == SPNAV_EVENT_ANY || qev->ev.type == type) {
+				if(qev->ev.type == SPNAV_EVENT_REQ) {
+					async_take(ctx, qev->ev.req.token, 0, 0);
+				}
+				rm_count++;
+			} else {
+				ctx->evq[(ctx->evq_rd + n++) % ctx->evq_size] = *qev;
+			}
+		}
+		ctx->evq_count = n;
+
+		/* then drain the daemon socket, keeping any events we didn't mean to
+		 * remove at the end of the queue
+		 */
+		while((n = read_events(ctx, evbuf, tsbuf, sizeof evbuf / sizeof *evbuf, 0)) > 0) {
+			for(i=0; i<n; i++) {
+				if(type == SPNAV_EVENT_ANY || evbuf[i].type == type) {
+					if(evbuf[i].type == SPNAV_EVENT_REQ) {
+						async_take(ctx, evbuf[i].req.token, 0, 0);
+					}
+					rm_count++;
+				} else {
+					enqueue_event(ctx, evbuf + i, tsbuf + i);
+				}
+			}
+		}
+
+		return rm_count;
+	}
+	return 0;
+}
+
+int spnav_ctx_queue_size(spnav_ctx *ctx, int size)
+{
+	int i;
+	struct queued_event *newq;
+
+	if(size < 1) {
+		return -1;
+	}
+
+	if(ctx->evq) {
+		/* already open, move any queued events to the new queue, dropping the
+		 * oldest ones if they don't fit
+		 */
+		if(!(newq = malloc(size * sizeof *newq))) {
+			return -1;
+		}
+		while(ctx->evq_count > size) {
+			if(ctx->evq[ctx->evq_rd].ev.type == SPNAV_EVENT_REQ) {
+				async_take(ctx, ctx->evq[ctx->evq_rd].ev.req.token, 0, 0);
+			}
+			remove_queued(ctx, 0);
+			ctx->evq_dropped++;
+		}
+		for(i=0; i<ctx->evq_count; i++) {
+			newq[i] = ctx->evq[(ctx->evq_rd + i) % ctx->evq_size];
+		}
+		free(ctx->evq);
+		ctx->evq = newq;
+		ctx->evq_rd = 0;
+	}
+	ctx->evq_size = size;
+	return 0;
+}
+
+unsigned long spnav_ctx_queue_dropped(spnav_ctx *ctx)
+{
+	unsigned long count = ctx->evq_dropped;
+
+#ifdef SPNAV_USE_THREADS
+	count += ATOMIC_LOAD(ctx->thr_dropped);
+#endif
+#ifdef SPNAV_USE_SHM
+	/* events the daemon couldn't fit in the shared memory ring */
+	if(ctx->shm) {
+		count += ATOMIC_LOAD_RLX(ctx->shm->dropped);
+	}
+#endif
+	return count;
+}
+
+static void get_time(struct spnav_timestamp *ts)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec tv;
+	clock_gettime(CLOCK_MONOTONIC, &tv);
+	ts->sec = tv.tv_sec;
+	ts->nsec = tv.tv_nsec;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	ts->sec = tv.tv_sec;
+	ts->nsec = tv.tv_usec * 1000;
+#endif
+}
+
+/* Applies an event to the current device state. Must only be called by the
+ * thread decoding events.
+ */
+static void update_state(struct spnav_ctx *ctx, const spnav_event *ev, const struct spnav_timestamp *ts)
+{
+	unsigned int seq = ctx->state_seq;
+
+	if(ev->type != SPNAV_EVENT_MOTION && ev->type != SPNAV_EVENT_BUTTON) {
+		return;
+	}
+	if(ev->type == SPNAV_EVENT_BUTTON && (ev->button.bnum < 0 || ev->button.bnum >= 32)) {
+		return;
+	}
+
+	ATOMIC_STORE_RLX(ctx->state_seq, seq + 1);
+	ATOMIC_FENCE_REL();
+
+	if(ev->type == SPNAV_EVENT_MOTION) {
+		ctx->cur_state.x = ev->motion.x;
+		ctx->cur_state.y = ev->motion.y;
+		ctx->cur_state.z = ev->motion.z;
+		ctx->cur_state.rx = ev->motion.rx;
+		ctx->cur_state.ry = ev->motion.ry;
+		ctx->cur_state.rz = ev->motion.rz;
+	} else {
+		if(ev->button.press) {
+			ctx->cur_state.buttons |= 1ul << ev->button.bnum;
+		} else {
+			ctx->cur_state.buttons &= ~(1ul << ev->button.bnum);
+		}
+	}
+	ctx->cur_state.time = *ts;
+
+	ATOMIC_STORE_REL(ctx->state_seq, seq + 2);
+}
+
+static void reset_state(struct spnav_ctx *ctx)
+{
+	unsigned int seq = ctx->state_seq;
+
+	ATOMIC_STORE_RLX(ctx->state_seq, seq + 1);
+	ATOMIC_FENCE_REL();
+	memset(&ctx->cur_state, 0, sizeof ctx->cur_state);
+	ATOMIC_STORE_REL(ctx->state_seq, seq + 2);
+}
+
+int spnav_ctx_get_state(spnav_ctx *ctx, struct spnav_state *st)
+{
+	unsigned int seq;
+
+	if(!IS_OPEN(ctx)) {
+		return -1;
+	}
+
+	do {
+		while((seq = ATOMIC_LOAD_ACQ(ctx->state_seq)) & 1);
+		memcpy(st, &ctx->cur_state, sizeof *st);
+		ATOMIC_FENCE_ACQ();
+	} while(ATOMIC_LOAD_RLX(ctx->state_seq) != seq);
+	return 0;
+}
+
+int spnav_ctx_coalesce(spnav_ctx *ctx, int mode)
+{
+	if(mode < SPNAV_COALESCE_NONE || mode > SPNAV_COALESCE_WEIGHTED) {
+		return -1;
+	}
+	ctx->coalesce = mode;
+	return 0;
+}
+
+#ifdef SPNAV_USE_THREADS
+/* reader thread: wake up the application, if it's not awake already */
+static void thr_wakeup(struct spnav_ctx *ctx)
+{
+	char c = 0;
+
+	if(!ATOMIC_XCHG(ctx->thr_wake, 1)) {
+		while(write(ctx->thr_wakepipe[1], &c, 1) == -1 && errno == EINTR);
+	}
+}
+
+/* reader thread: pass a request response to the application */
+static void thr_post_resp(struct spnav_ctx *ctx, const int32_t *pkt)
+{
+	pthread_mutex_lock(&ctx->thr_mbox_lock);
+	if(ctx->thr_mbox_count >= THR_MBOX_SIZE) {
+		/* nobody is waiting for the oldest one, drop it */
+		ctx->thr_mbox_rd = (ctx->thr_mbox_rd + 1) % THR_MBOX_SIZE;
+		ctx->thr_mbox_count--;
+	}
+	memcpy(ctx->thr_mbox + (ctx->thr_mbox_rd + ctx->thr_mbox_count++) % THR_MBOX_SIZE, pkt,
+			sizeof *ctx->thr_mbox);
+	pthread_cond_signal(&ctx->thr_mbox_cond);
+	pthread_mutex_unlock(&ctx->thr_mbox_lock);
+}
+
+static void *thr_func(void *arg)
+{
+	struct spnav_ctx *ctx = arg;
+	unsigned int wr;
+	int tmo, full;
+	int32_t *pkt;
+	struct queued_event *qev;
+	spnav_event ev;
+	struct pollfd pfd[2];
+
+	/* when replaying, poll only waits for the next event to become due */
+	pfd[0].fd = IS_REPLAY(ctx) ? -1 : ctx->sock;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = ctx->thr_ctlpipe[0];
+	pfd[1].events = POLLIN;
+
+	for(;;) {
+		/* don't wait if there are events in the shared memory ring already.
+		 * In that case the poll call only checks for a stop request, and
+		 * whether there are any responses to read from the socket.
+		 */
+		tmo = SHM_PENDING(ctx) ? 0 : -1;
+		full = 0;
+		if(IS_REPLAY(ctx)) {
+			/* there's no socket buffer to hold back a replay when the ring is
+			 * full, so wait for the application instead of dropping events
+			 */
+			full = ctx->thr_wr - ATOMIC_LOAD(ctx->thr_rd) > THR_RING_SIZE - RXBUF_EVENTS;
+			tmo = full ? 1 : replay_timeout(ctx);
+		}
+		if(poll(pfd, 2, tmo) == -1) {
+			if(errno == EINTR) continue;
+			break;
+		}
+		if(pfd[1].revents) break;	/* stop requested */
+		if(full) continue;
+
+		if(rx_fill(ctx, 0, pfd[0].revents) == -1) {
+			break;
+		}
+
+		wr = ctx->thr_wr;
+		while((pkt = rx_packet(ctx))) {
+			if((pkt[0] & 0xffff0000) == REQ_TAG) {
+				if(!async_resp(ctx, pkt, &ev)) {
+					thr_post_resp(ctx, pkt);
+				} else if(ev.type) {
+					/* async request completions go through the ring, like events */
+					if(wr - ATOMIC_LOAD(ctx->thr_rd) >= THR_RING_SIZE) {
+						async_take(ctx, ev.req.token, 0, 0);
+						ATOMIC_STORE(ctx->thr_dropped, ctx->thr_dropped + 1);
+						continue;
+					}
+					qev = ctx->thr_ring + (wr++ & (THR_RING_SIZE - 1));
+					qev->ev = ev;
+					qev->ts = ctx->rx_time;
+				}
+				continue;
+			}
+			if(wr - ATOMIC_LOAD(ctx->thr_rd) >= THR_RING_SIZE) {
+				/* still decode it, to keep the device state current */
+				if(proc_event(ctx, pkt, &ev) > 0) {
+					ATOMIC_STORE(ctx->thr_dropped, ctx->thr_dropped + 1);
+				}
+				continue;
+			}
+			qev = ctx->thr_ring + (wr & (THR_RING_SIZE - 1));
+			if(proc_event(ctx, pkt, &qev->ev) > 0) {
+				qev->ts = ctx->rx_time;
+				wr++;
+			}
+		}
+
+		if(wr != ctx->thr_wr) {
+			ATOMIC_STORE(ctx->thr_wr, wr);
+			thr_wakeup(ctx);
+		}
+	}
+
+	/* connection closed or stop requested, wake up anyone waiting */
+	ATOMIC_STORE(ctx->thr_eof, 1);
+	thr_wakeup(ctx);
+	pthread_mutex_lock(&ctx->thr_mbox_lock);
+	pthread_cond_broadcast(&ctx->thr_mbox_cond);
+	pthread_mutex_unlock(&ctx->thr_mbox_lock);
+	return 0;
+}
+
+/* Same as read_events, but takes events from the reader thread handoff ring.
+ * This doesn't make any system calls while there are pending events.
+ */
+static int thr_read_events(struct spnav_ctx *ctx, spnav_event *evbuf, struct spnav_timestamp *tsbuf,
+		int max, int block)
+{
+	int count = 0;
+	unsigned int rd, wr;
+	char c;
+	struct queued_event *qev;
+	struct pollfd pfd;
+
+	for(;;) {
+		rd = ctx->thr_rd;
+		wr = ATOMIC_LOAD(ctx->thr_wr);
+		while(count < max && rd != wr) {
+			qev = ctx->thr_ring + (rd++ & (THR_RING_SIZE - 1));
+			evbuf[count] = qev->ev;
+			if(evbuf[count].type == SPNAV_EVENT_MOTION) {
+				evbuf[count].motion.data = &evbuf[count].motion.x;
+			}
+			if(tsbuf) {
+				tsbuf[count] = qev->ts;
+			}
+			count++;
+		}
+		ATOMIC_STORE(ctx->thr_rd, rd);
+		if(count) {
+			return count;
+		}
+
+		/* The ring is empty. Clear the wakeup flag and pipe, and if they were
+		 * set, check the ring again, in case an event arrived in the meantime.
+		 * Otherwise the reader thread will write to the pipe for the next one.
+		 */
+		if(ATOMIC_XCHG(ctx->thr_wake, 0)) {
+			while(read(ctx->thr_wakepipe[0], &c, 1) == -1 && errno == EINTR);
+			continue;
+		}
+		if(ATOMIC_LOAD(ctx->thr_eof)) {
+			return -1;
+		}
+		if(!block) {
+			return 0;
+		}
+
+		pfd.fd = ctx->thr_wakepipe[0];
+		pfd.events = POLLIN;
+		while(poll(&pfd, 1, -1) == -1 && errno == EINTR);
+	}
+}
+
+static int thr_wait_resp(struct spnav_ctx *ctx, void *buf, int sz, int timeout_ms)
+{
+	int res = 0;
+	struct timespec ts;
+
+	if(timeout_ms > 0) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += timeout_ms / 1000;
+		ts.tv_nsec += (timeout_ms % 1000) * 1000000;
+		if(ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+	}
+
+	pthread_mutex_lock(&ctx->thr_mbox_lock);
+	while(!ctx->thr_mbox_count && !ATOMIC_LOAD(ctx->thr_eof) && res == 0) {
+		if(timeout_ms > 0) {
+			res = pthread_cond_timedwait(&ctx->thr_mbox_cond, &ctx->thr_mbox_lock, &ts);
+		} else {
+			pthread_cond_wait(&ctx->thr_mbox_cond, &ctx->thr_mbox_lock);
+		}
+	}
+	if(!ctx->thr_mbox_count) {
+		pthread_mutex_unlock(&ctx->thr_mbox_lock);
+		return -1;
+	}
+	memcpy(buf, ctx->thr_mbox + ctx->thr_mbox_rd, sz < sizeof *ctx->thr_mbox ? sz : sizeof *ctx->thr_mbox);
+	ctx->thr_mbox_rd = (ctx->thr_mbox_rd + 1) % THR_MBOX_SIZE;
+	ctx->thr_mbox_count--;
+	pthread_mutex_unlock(&ctx->thr_mbox_lock);
+	return 0;
+}
+
+static void thr_flush_resp(struct spnav_ctx *ctx)
+{
+	pthread_mutex_lock(&ctx->thr_mbox_lock);
+	ctx->thr_mbox_rd = ctx->thr_mbox_count = 0;
+	pthread_mutex_unlock(&ctx->thr_mbox_lock);
+}
+
+static void thr_stop(struct spnav_ctx *ctx)
+{
+	char c = 0;
+	int i, n;
+	spnav_event evbuf[32];
+	struct spnav_timestamp tsbuf[32];
+
+	if(!ctx->thr_running) return;
+
+	while(write(ctx->thr_ctlpipe[1], &c, 1) == -1 && errno == EINTR);
+	pthread_join(ctx->thr, 0);
+
+	/* move any events left in the handoff ring to the event queue */
+	ATOMIC_STORE(ctx->thr_eof, 0);
+	while((n = thr_read_events(ctx, evbuf, tsbuf, 32, 0)) > 0) {
+		for(i=0; i<n; i++) {
+			enqueue_event(ctx, evbuf + i, tsbuf + i);
+		}
+	}
+	ctx->evq_dropped += ctx->thr_dropped;
+	ctx->thr_dropped = 0;
+	ctx->thr_running = 0;
+
+	/* and any responses left in the mailbox to the response stash */
+	for(i=0; i<ctx->thr_mbox_count; i++) {
+		stash_resp(ctx, (int32_t*)(ctx->thr_mbox + (ctx->thr_mbox_rd + i) % THR_MBOX_SIZE));
+	}
+
+	close(ctx->thr_wakepipe[0]);
+	close(ctx->thr_wakepipe[1]);
+	close(ctx->thr_ctlpipe[0]);
+	close(ctx->thr_ctlpipe[1]);
+	pthread_mutex_destroy(&ctx->thr_mbox_lock);
+	pthread_cond_destroy(&ctx->thr_mbox_cond);
+	free(ctx->thr_ring);
+	ctx->thr_ring = 0;
+}
+#endif	/* SPNAV_USE_THREADS */
+
+int spnav_ctx_reader_thread(spnav_ctx *ctx, int enable)
+{
+#ifdef SPNAV_USE_THREADS
+	if(ctx->sock == -1) {
+		return -1;
+	}
+
+	if(!enable) {
+		thr_stop(ctx);
+		return 0;
+	}
+	if(ctx->thr_running) {
+		return 0;
+	}
+
+	if(!(ctx->thr_ring = malloc(THR_RING_SIZE * sizeof *ctx->thr_ring))) {
+		return -1;
+	}
+	if(pipe(ctx->thr_wakepipe) == -1) {
+		goto err_ring;
+	}
+	if(pipe(ctx->thr_ctlpipe) == -1) {
+		goto err_wakepipe;
+	}
+	ctx->thr_rd = ctx->thr_wr = 0;
+	ctx->thr_wake = ctx->thr_eof = 0;
+	ctx->thr_dropped = 0;
+	/* hand any stashed responses over to the mailbox */
+	memcpy(ctx->thr_mbox, ctx->respq, sizeof ctx->respq);
+	ctx->thr_mbox_rd = ctx->respq_rd;
+	ctx->thr_mbox_count = ctx->respq_count;
+	ctx->respq_rd = ctx->respq_count = 0;
+	pthread_mutex_init(&ctx->thr_mbox_lock, 0);
+	pthread_cond_init(&ctx->thr_mbox_cond, 0);
+
+	if(pthread_create(&ctx->thr, 0, thr_func, ctx) != 0) {
+		pthread_mutex_destroy(&ctx->thr_mbox_lock);
+		pthread_cond_destroy(&ctx->thr_mbox_cond);
+		close(ctx->thr_ctlpipe[0]);
+		close(ctx->thr_ctlpipe[1]);
+		goto err_wakepipe;
+	}
+	ctx->thr_running = 1;
+	return 0;
+
+err_wakepipe:
+	close(ctx->thr_wakepipe[0]);
+	close(ctx->thr_wakepipe[1]);
+err_ring:
+	free(ctx->thr_ring);
+	ctx->thr_ring = 0;
+	return -1;
+#else
+	return -1;	/* built without thread support */
+#endif
+}
+
+#ifdef SPNAV_USE_X11
+int spnav_ctx_x11_event(spnav_ctx *ctx, const XEvent *xev, spnav_event *event)
+{
+	int i;
+	int xmsg_type;
+	struct spnav_timestamp ts;
+
+	if(xev->type != ClientMessage) {
+		return 0;
+	}
+
+	xmsg_type = xev->xclient.message_type;
+
+	if(xmsg_type != ctx->motion_event && xmsg_type != ctx->button_press_event &&
+			xmsg_type != ctx->button_release_event) {
+		return 0;
+	}
+
+	if(xmsg_type == ctx->motion_event) {
+		event->type = SPNAV_EVENT_MOTION;
+		event->motion.data = &event->motion.x;
+
+		for(i=0; i<6; i++) {
+			event->motion.data[i] = xev->xclient.data.s[i + 2];
+		}
+		event->motion.period = xev->xclient.data.s[8];
+	} else {
+		event->type = SPNAV_EVENT_BUTTON;
+		event->button.press = xmsg_type == ctx->button_press_event ? 1 : 0;
+		event->button.bnum = xev->xclient.data.s[2];
+	}
+
+	get_time(&ts);
+	update_state(ctx, event, &ts);
+	return event->type;
+}
+
+
+static Window get_daemon_window(struct spnav_ctx *ctx)
+{
+	Window win, root_win;
+	XTextProperty wname;
+	Atom type;
+	int fmt;
+	unsigned long nitems, bytes_after;
+	unsigned char *prop;
+
+	root_win = DefaultRootWindow(ctx->dpy);
+
+	XGetWindowProperty(ctx->dpy, root_win, ctx->command_event, 0, 1, False, AnyPropertyType, &type, &fmt, &nitems, &bytes_after, &prop);
+	if(!prop) {
+		return 0;
+	}
+
+	win = *(Window*)prop;
+	XFree(prop);
+
+	if(!XGetWMName(ctx->dpy, win, &wname) || strcmp("Magellan Window", (char*)wname.value) != 0) {
+		return 0;
+	}
+
+	return win;
+}
+
+int catch_badwin(Display *dpy, XErrorEvent *err)
+{
+	char buf[256];
+
+	if(err->error_code == BadWindow) {
+		/* do nothing? */
+	} else {
+		XGetErrorText(dpy, err->error_code, buf, sizeof buf);
+		fprintf(stderr, "libspnav: caught unexpected X error: %s\n", buf);
+	}
+	return 0;
+}
+#endif
+
+/* Demultiplexes the packets in the receive buffer: events are decoded into the
+ * event queue, until a request response is found. Returns a pointer to the
+ * response, which is consumed, or a null pointer if there aren't any buffered.
+ */
+static int32_t *rx_demux(struct spnav_ctx *ctx)
+{
+	int32_t *pkt;
+	spnav_event ev;
+
+	while((pkt = rx_packet(ctx))) {
+		if((pkt[0] & 0xffff0000) == REQ_TAG) {
+			if(async_resp(ctx, pkt, &ev)) {
+				if(ev.type) {
+					enqueue_event(ctx, &ev, &ctx->rx_time);
+				}
+				continue;
+			}
+			return pkt;
+		}
+		if(proc_event(ctx, pkt, &ev) > 0) {
+			enqueue_event(ctx, &ev, &ctx->rx_time);
+		}
+	}
+	return 0;
+}
+
+/* Discards any stale responses pending in the receive buffer and the daemon
+ * socket, left over from requests which timed out. Events are kept in the
+ * event queue.
+ */
+static void flush_resp(struct spnav_ctx *ctx)
+{
+	/* the device descriptor responses are not stale, collect them first */
+	if(ctx->dinfo_state == DINFO_PENDING) {
+		dev_collect(ctx);
+	}
+
+#ifdef SPNAV_USE_THREADS
+	if(ctx->thr_running) {
+		thr_flush_resp(ctx);
+		return;
+	}
+#endif
+
+	ctx->respq_rd = ctx->respq_count = 0;
+	do {
+		while(rx_demux(ctx));
+	} while(rx_fill(ctx, 0, 1) > 0);
+}
+
+/* Waits for the next request response. Any events arriving before it are
+ * decoded into the event queue, so that they'll be delivered in order by the
+ * next call to spnav_poll_event or spnav_wait_event. Negative or zero
+ * timeout_ms means wait forever.
+ */
+static int wait_resp(struct spnav_ctx *ctx, void *buf, int sz, int timeout_ms)
+{
+	int res, msec;
+	int32_t *pkt;
+	struct pollfd pfd;
+	struct spnav_timestamp start, now;
+
+#ifdef SPNAV_USE_THREADS
+	if(ctx->thr_running) {
+		return thr_wait_resp(ctx, buf, sz, timeout_ms);
+	}
+#endif
+
+	if(ctx->respq_count) {
+		memcpy(buf, ctx->respq + ctx->respq_rd, sz);
+		ctx->respq_rd = (ctx->respq_rd + 1) % RESPQ_SIZE;
+		ctx->respq_count--;
+		return 0;
+	}
+
+	get_time(&start);
+	for(;;) {
+		if((pkt = rx_demux(ctx))) {
+			memcpy(buf, pkt, sz);
+			return 0;
+		}
+
+		if(timeout_ms > 0) {
+			get_time(&now);
+			msec = timeout_ms - (now.sec - start.sec) * 1000 - (now.nsec - start.nsec) / 1000000;
+			if(msec <= 0) {
+				return -1;
+			}
+
+			pfd.fd = ctx->sock;
+			pfd.events = POLLIN;
+			while((res = poll(&pfd, 1, msec)) == -1 && errno == EINTR);
+
+			if(res <= 0 || !(pfd.revents & (POLLIN | POLLHUP))) {
+				return -1;
+			}
+		}
+
+		if(rx_fill(ctx, 1, 1) == -1) {
+			return -1;
+		}
+	}
+}
+
+/* Writes size bytes to the daemon socket, resuming after short writes.
+ * Returns 0 on success, -1 on failure.
+ */
+static int send_all(struct spnav_ctx *ctx, const void *buf, int size)
+{
+	int wr;
+	const char *ptr = buf;
+
+	while(size > 0) {
+		if((wr = write(ctx->sock, ptr, size)) == -1) {
+			if(errno == EINTR) continue;
+			return -1;
+		}
+		ptr += wr;
+		size -= wr;
+	}
+	return 0;
+}
+
+static int request(struct spnav_ctx *ctx, int req, struct reqresp *rr, int timeout_ms)
+{
+	unsigned int gen;
+
+	if(ctx->sock < 0 || ctx->proto < 1) return -1;
+
+	if(ctx->cfgb_active && cfg_batchable(req)) {
+		return cfg_batch_add(ctx, req, rr);
+	}
+	if(cfg_cache_get(ctx, req, rr) == 0) {
+		return 0;
+	}
+	gen = ATOMIC_LOAD(ctx->cfgc_gen);
+
+	flush_resp(ctx);
+
+	req |= REQ_TAG;
+	rr->type = req;
+
+	write(ctx->sock, rr, sizeof *rr);
+	do {
+		/* skip late responses to earlier requests which timed out */
+		if(wait_resp(ctx, rr, sizeof *rr, timeout_ms) == -1) {
+			return -1;
+		}
+	} while(rr->type != req);
+
+	/* XXX assuming data[6] is always status */
+	if(rr->data[6] < 0) return -1;
+
+	cfg_cache_update(ctx, req & 0xffff, rr, gen);
+	return 0;
+}
+
+static int request_str(struct spnav_ctx *ctx, int req, char *buf, int bufsz, int timeout_ms)
+{
+	int res = -1;
+	struct reqresp rr = {0};
+	struct reqresp_strbuf sbuf = {0};
+
+	if(request(ctx, req, &rr, timeout_ms) == -1) {
+		return -1;
+	}
+
+	/* reassemble the string straight into buf, if it fits */
+	while((res = spnav_recv_str_buf(&sbuf, &rr, buf, bufsz)) == 0) {
+		if(wait_resp(ctx, &rr, sizeof rr, timeout_ms) == -1) {
+			res = -1;
+			break;
+		}
+	}
+
+	if(sbuf.extbuf) {
+		if(res == -1) {
+			*buf = 0;	/* don't leave a partial string behind */
+			return -1;
+		}
+		return sbuf.size - 1;
+	}
+
+	if(res == -1) {
+		free(sbuf.buf);
+		return -1;
+	}
+
+	/* didn't fit, return it truncated */
+	if(buf) {
+		strncpy(buf, sbuf.buf, bufsz - 1);
+		buf[bufsz - 1] = 0;
+	}
+	free(sbuf.buf);
+	return sbuf.size - 1;
+}
+
+/* Pipelined request for a range of entries of a per-axis or per-button config
+ * table. Requests are written in bursts of up to MAX_PIPELINE, and then their
+ * responses are collected, which arrive in the same order. For set requests,
+ * the values are taken from setvals, for get requests they're written to
+ * getvals. Responses are matched by type and table index, so that late
+ * responses to earlier requests which timed out aren't taken for the wrong
+ * entry.
+ */
+static int request_table(struct spnav_ctx *ctx, int req, int first, int count,
+		const int *setvals, int *getvals, int timeout_ms)
+{
+	int i, n, res = 0;
+	unsigned int gen;
+	struct reqresp rr[MAX_PIPELINE];
+
+	if(ctx->sock < 0 || ctx->proto < 1 || first < 0 || count < 0) return -1;
+
+	if(ctx->cfgb_active && setvals) {
+		memset(rr, 0, sizeof *rr);
+		for(i=0; i<count; i++) {
+			rr[0].data[0] = first + i;
+			rr[0].data[1] = setvals[i];
+			if(cfg_batch_add(ctx, req, rr) == -1) {
+				return -1;
+			}
+		}
+		return 0;
+	}
+
+	if(getvals) {
+		/* skip the requests altogether if the whole range is cached */
+		for(i=0; i<count; i++) {
+			rr[0].data[0] = first + i;
+			if(cfg_cache_get(ctx, req, rr) == -1) {
+				break;
+			}
+			getvals[i] = rr[0].data[1];
+		}
+		if(i >= count) {
+			return 0;
+		}
+	}
+	gen = ATOMIC_LOAD(ctx->cfgc_gen);
+
+	flush_resp(ctx);
+
+	req |= REQ_TAG;
+	while(count > 0) {
+		n = count > MAX_PIPELINE ? MAX_PIPELINE : count;
+
+		memset(rr, 0, n * sizeof *rr);
+		for(i=0; i<n; i++) {
+			rr[i].type = req;
+			rr[i].data[0] = first + i;
+			if(setvals) {
+				rr[i].data[1] = setvals[i];
+			}
+		}
+		if(send_all(ctx, rr, n * sizeof *rr) == -1) {
+			return -1;
+		}
+
+		for(i=0; i<n; i++) {
+			do {
+				if(wait_resp(ctx, rr + i, sizeof *rr, timeout_ms) == -1) {
+					return -1;
+				}
+				/* error responses don't necessarily carry the index, but
+				 * they're harmless, they never reach the cache
+				 */
+			} while(rr[i].type != req || (rr[i].data[0] != first + i && rr[i].data[6] >= 0));
+
+			if(rr[i].data[6] < 0) {
+				res = -1;
+				continue;
+			}
+			if(getvals) {
+				getvals[i] = rr[i].data[1];
+			}
+			cfg_cache_update(ctx, req & 0xffff, rr + i, gen);
+		}
+
+		first += n;
+		count -= n;
+		if(setvals) setvals += n;
+		if(getvals) getvals += n;
+	}
+	return res;
+}
+
+/* ---- asynchronous requests ---- */
+
+/* requests which can be sent with spnav_request_async: everything with fixed
+ * size arguments and responses, except for changing the event mask, which is
+ * tracked by the library (see spnav_ctx_evmask).
+ */
+static int async_valid(int req)
+{
+	if(req >= REQ_SET_SENS && req <= REQ_GET_EVMASK) {
+		return req != REQ_SET_EVMASK;
+	}
+	if(req >= REQ_DEV_NAXES && req <= REQ_DEV_TYPE) {
+		return 1;
+	}
+	if(req >= REQ_SCFG_SENS && req <= REQ_GCFG_REPEAT) {
+		return req != REQ_SCFG_SERDEV && req != REQ_GCFG_SERDEV;
+	}
+	return req >= REQ_CFG_SAVE && req <= REQ_CFG_RESET;
+}
+
+/* must be called with req_lock held */
+static void async_release(struct spnav_ctx *ctx, struct async_req *ar)
+{
+	memset(ar, 0, sizeof *ar);
+	ATOMIC_STORE(ctx->areq_live, ctx->areq_live - 1);
+}
+
+/* Matches a response to the oldest asynchronous request of the same type in
+ * flight. Called by whoever reads from the socket, which might be the reader
+ * thread. If it's a match, fills ev with the completion event to be queued,
+ * or sets ev->type to 0 if the request was orphaned, and returns 1. Returns 0
+ * if the response doesn't belong to an asynchronous request.
+ */
+static int async_resp(struct spnav_ctx *ctx, const int32_t *pkt, spnav_event *ev)
+{
+	int i, req;
+	unsigned int gen;
+	struct reqresp rr;
+	struct async_req *ar, *match = 0;
+
+	if(!ATOMIC_LOAD(ctx->areq_live)) return 0;
+
+	req = pkt[0] & 0xffff;
+
+	REQ_LOCK(ctx);
+	for(i=0; i<MAX_ASYNC_REQ; i++) {
+		ar = ctx->areq + i;
+		if(ar->token && ar->inflight && ar->req == req &&
+				(!match || (int)(ar->seq - match->seq) < 0)) {
+			match = ar;
+		}
+	}
+	if(!match) {
+		REQ_UNLOCK(ctx);
+		return 0;
+	}
+	match->inflight = 0;
+
+	if(match->orphan) {
+		/* canceled or expired, just swallow the response */
+		if(!match->queued) {
+			async_release(ctx, match);
+		}
+		REQ_UNLOCK(ctx);
+		ev->type = 0;
+		return 1;
+	}
+
+	ev->req.type = SPNAV_EVENT_REQ;
+	ev->req.token = match->token;
+	ev->req.status = pkt[7] < 0 ? SPNAV_REQ_FAILED : 0;
+	for(i=0; i<6; i++) {
+		ev->req.data[i] = pkt[i + 1];
+	}
+	match->queued = 1;
+	gen = match->cfg_gen;
+	REQ_UNLOCK(ctx);
+
+	if(!ev->req.status) {
+		memcpy(&rr, pkt, sizeof rr);
+		cfg_cache_update(ctx, req, &rr, gen);
+	}
+	return 1;
+}
+
+/* returns the milliseconds from now until ts, rounded up */
+static int msec_until(const struct spnav_timestamp *ts, const struct spnav_timestamp *now)
+{
+	long msec = (ts->sec - now->sec) * 1000 + (ts->nsec - now->nsec + 999999) / 1000000;
+	return msec > 0 ? msec : 0;
+}
+
+/* Completes any asynchronous requests past their deadline with a timeout
+ * event. Their responses will be discarded when they arrive.
+ */
+static void async_expire(struct spnav_ctx *ctx)
+{
+	int i, count = 0;
+	spnav_event evbuf[MAX_ASYNC_REQ];
+	struct spnav_timestamp now;
+	struct async_req *ar;
+
+	get_time(&now);
+
+	REQ_LOCK(ctx);
+	for(i=0; i<MAX_ASYNC_REQ; i++) {
+		ar = ctx->areq + i;
+		if(ar->token && ar->has_deadline && ar->inflight && !ar->queued && !ar->orphan &&
+				msec_until(&ar->deadline, &now) <= 0) {
+			ar->orphan = ar->queued = 1;
+			memset(evbuf + count, 0, sizeof *evbuf);
+			evbuf[count].req.type = SPNAV_EVENT_REQ;
+			evbuf[count].req.token = ar->token;
+			evbuf[count].req.status = SPNAV_REQ_TIMEOUT;
+			count++;
+		}
+	}
+	REQ_UNLOCK(ctx);
+
+	/* enqueue_event might drop a completion and call async_take, so do it
+	 * after releasing the lock
+	 */
+	for(i=0; i<count; i++) {
+		enqueue_event(ctx, evbuf + i, &now);
+	}
+}
+
+/* Returns the milliseconds until the earliest pending deadline, or -1 */
+static int async_timeout(struct spnav_ctx *ctx)
+{
+	int i, msec, res = -1;
+	struct spnav_timestamp now;
+	struct async_req *ar;
+
+	if(!ATOMIC_LOAD(ctx->areq_live)) return -1;
+
+	get_time(&now);
+
+	REQ_LOCK(ctx);
+	for(i=0; i<MAX_ASYNC_REQ; i++) {
+		ar = ctx->areq + i;
+		if(ar->token && ar->has_deadline && ar->inflight && !ar->queued && !ar->orphan) {
+			msec = msec_until(&ar->deadline, &now);
+			if(res == -1 || msec < res) {
+				res = msec;
+			}
+		}
+	}
+	REQ_UNLOCK(ctx);
+	return res;
+}
+
+/* Called before reading events, to expire due asynchronous requests. If block
+ * is non-zero, and there are deadlines pending, waits for input until the
+ * earliest one, expires it, and returns 0 so that the caller doesn't block
+ * past it. Otherwise returns block.
+ */
+static int async_wait(struct spnav_ctx *ctx, int block)
+{
+	int msec;
+	struct pollfd pfd;
+
+	if(!ATOMIC_LOAD(ctx->areq_live)) return block;
+
+	async_expire(ctx);
+	if((msec = async_timeout(ctx)) == -1) {
+		return block;
+	}
+	if(!block || msec == 0 || ctx->evq_count) {
+		return 0;
+	}
+
+	pfd.fd = ctx->sock;
+#ifdef SPNAV_USE_THREADS
+	if(ctx->thr_running) {
+		if(ATOMIC_LOAD(ctx->thr_wr) != ctx->thr_rd) {
+			return 0;
+		}
+		pfd.fd = ctx->thr_wakepipe[0];
+	} else
+#endif
+	if(ctx->rx_end - ctx->rx_start >= 8 * sizeof *ctx->rxbuf || SHM_PENDING(ctx)) {
+		return 0;
+	}
+	pfd.events = POLLIN;
+	while(poll(&pfd, 1, msec) == -1 && errno == EINTR);
+
+	async_expire(ctx);
+	return 0;
+}
+
+/* Releases the slot of a queued completion which is being delivered or
+ * dropped, and returns its callback through cb and cls, if they're not null.
+ * Returns -1 if the request was canceled in the meantime.
+ */
+static int async_take(struct spnav_ctx *ctx, int token, spnav_request_callback *cb, void **cls)
+{
+	int i;
+	struct async_req *ar;
+
+	REQ_LOCK(ctx);
+	for(i=0; i<MAX_ASYNC_REQ; i++) {
+		ar = ctx->areq + i;
+		if(ar->token == token && ar->queued) {
+			if(cb) *cb = ar->cb;
+			if(cls) *cls = ar->cls;
+			ar->queued = 0;
+			if(!ar->inflight) {
+				async_release(ctx, ar);
+			}
+			REQ_UNLOCK(ctx);
+			return 0;
+		}
+	}
+	REQ_UNLOCK(ctx);
+	return -1;
+}
+
+/* Delivers the request completions in a batch of events about to be returned
+ * to the application. Completions of canceled requests are removed, and so are
+ * the ones with a callback, after calling it. Returns the number of events
+ * left in evbuf.
+ */
+static int async_filter(struct spnav_ctx *ctx, spnav_event *evbuf, struct spnav_timestamp *tsbuf,
+		int count)
+{
+	int i, n = 0;
+	spnav_request_callback cb;
+	void *cls;
+
+	for(i=0; i<count; i++) {
+		if(evbuf[i].type == SPNAV_EVENT_REQ) {
+			cb = 0;
+			if(async_take(ctx, evbuf[i].req.token, &cb, &cls) == -1) {
+				continue;
+			}
+			if(cb) {
+				cb(&evbuf[i].req, cls);
+				continue;
+			}
+		}
+		if(n != i) {
+			evbuf[n] = evbuf[i];
+			if(evbuf[n].type == SPNAV_EVENT_MOTION) {
+				evbuf[n].motion.data = &evbuf[n].motion.x;
+			}
+			if(tsbuf) {
+				tsbuf[n] = tsbuf[i];
+			}
+		}
+		n++;
+	}
+	return n;
+}
+
+int spnav_ctx_request_async(spnav_ctx *ctx, int req, const int *data, int timeout_ms,
+		spnav_request_callback cb, void *cls)
+{
+	int i, token;
+	struct reqresp rr = {0};
+	struct async_req *ar = 0;
+
+	if(ctx->sock < 0 || ctx->proto < 1 || !async_valid(req)) return -1;
+
+	REQ_LOCK(ctx);
+	for(i=0; i<MAX_ASYNC_REQ; i++) {
+		if(!ctx->areq[i].token) {
+			ar = ctx->areq + i;
+			break;
+		}
+	}
+	if(!ar) {
+		REQ_UNLOCK(ctx);
+		return -1;
+	}
+
+	if(++ctx->areq_token <= 0) {
+		ctx->areq_token = 1;
+	}
+	token = ctx->areq_token;
+
+	/* fill the slot before sending, the response might beat us to it */
+	ar->token = token;
+	ar->req = req;
+	ar->seq = ctx->areq_seq++;
+	ar->inflight = 1;
+	if((ar->has_deadline = timeout_ms > 0)) {
+		get_time(&ar->deadline);
+		ar->deadline.sec += timeout_ms / 1000;
+		ar->deadline.nsec += (timeout_ms % 1000) * 1000000;
+		if(ar->deadline.nsec >= 1000000000) {
+			ar->deadline.sec++;
+			ar->deadline.nsec -= 1000000000;
+		}
+	}
+	ar->cfg_gen = ATOMIC_LOAD(ctx->cfgc_gen);
+	ar->cb = cb;
+	ar->cls = cls;
+	ATOMIC_STORE(ctx->areq_live, ctx->areq_live + 1);
+	REQ_UNLOCK(ctx);
+
+	rr.type = REQ_TAG | req;
+	if(data) {
+		for(i=0; i<6; i++) {
+			rr.data[i] = data[i];
+		}
+	}
+	if(write(ctx->sock, &rr, sizeof rr) != sizeof rr) {
+		REQ_LOCK(ctx);
+		async_release(ctx, ar);
+		REQ_UNLOCK(ctx);
+		return -1;
+	}
+	return token;
+}
+
+int spnav_ctx_request_cancel(spnav_ctx *ctx, int token)
+{
+	int i;
+	struct async_req *ar;
+
+	if(token <= 0) return -1;
+
+	REQ_LOCK(ctx);
+	for(i=0; i<MAX_ASYNC_REQ; i++) {
+		ar = ctx->areq + i;
+		if(ar->token == token && !ar->orphan) {
+			if(ar->inflight) {
+				/* the response is still coming, discard it when it arrives */
+				ar->orphan = 1;
+				ar->queued = 0;
+			} else {
+				/* the completion is queued, it will be skipped */
+				async_release(ctx, ar);
+			}
+			REQ_UNLOCK(ctx);
+			return 0;
+		}
+	}
+	REQ_UNLOCK(ctx);
+	return -1;
+}
+
+int spnav_ctx_request_timeout(spnav_ctx *ctx)
+{
+	return async_timeout(ctx);
+}
+
+
+
+int spnav_ctx_protocol(spnav_ctx *ctx)
+{
+	return ctx->proto;
+}
+
+int spnav_ctx_client_name(spnav_ctx *ctx, const char *name)
+{
+	return spnav_send_str(ctx->sock, REQ_SET_NAME, name);
+}
+
+int spnav_ctx_evmask(spnav_ctx *ctx, unsigned int mask)
+{
+	struct reqresp rr = {0};
+
+	/* keep config events coming, if the config cache needs them */
+	rr.data[0] = ctx->cfgc_state > 0 ? mask | SPNAV_EVMASK_CFG : mask;
+	if(request(ctx, REQ_SET_EVMASK, &rr, TIMEOUT) == -1) {
+		return -1;
+	}
+	ATOMIC_STORE(ctx->evmask, mask);
+	return 0;
+}
+
+/* Looks for a device in the device table, by id, or by type and USB id if
+ * id is -1. Must be called with dev_lock held. Returns the index or -1.
+ */
+static int find_device(struct spnav_ctx *ctx, int id, int type, const unsigned int *usbid)
+{
+	int i;
+	struct device *dev;
+
+	for(i=0; i<ctx->num_devs; i++) {
+		dev = ctx->devs + i;
+		if(id >= 0 && dev->id >= 0) {
+			if(dev->id == id) return i;
+		} else if(dev->type == type && dev->usbid[0] == usbid[0] && dev->usbid[1] == usbid[1]) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* Updates the device table from a device event */
+static void track_device(struct spnav_ctx *ctx, const struct spnav_event_dev *ev)
+{
+	int idx;
+	unsigned int usbid[2];
+	struct device *dev;
+
+	usbid[0] = ev->usbid[0];
+	usbid[1] = ev->usbid[1];
+
+	ATOMIC_STORE(ctx->dinfo_stale, 1);
+
+	DEV_LOCK(ctx);
+	idx = find_device(ctx, ev->id, ev->devtype, usbid);
+
+	if(ev->op == SPNAV_DEV_ADD) {
+		if(idx == -1) {
+			if(ctx->num_devs >= MAX_DEVICES) {
+				DEV_UNLOCK(ctx);
+				return;
+			}
+			idx = ctx->num_devs++;
+			ctx->devs[idx].remote = 0;
+		}
+		dev = ctx->devs + idx;
+		dev->id = ev->id;
+		dev->type = ev->devtype;
+		dev->usbid[0] = usbid[0];
+		dev->usbid[1] = usbid[1];
+
+	} else if(ev->op == SPNAV_DEV_RM && idx >= 0) {
+		memmove(ctx->devs + idx, ctx->devs + idx + 1, (ctx->num_devs - idx - 1) * sizeof *ctx->devs);
+		ctx->num_devs--;
+		if(ctx->sel_dev > idx || ctx->sel_dev >= ctx->num_devs) {
+			ctx->sel_dev = ctx->sel_dev > 0 ? ctx->sel_dev - 1 : 0;
+		}
+	}
+	DEV_UNLOCK(ctx);
+}
+
+static const int dinfo_req[] = {
+	REQ_DEV_NAME, REQ_DEV_PATH, REQ_DEV_NAXES, REQ_DEV_NBUTTONS, REQ_DEV_USBID, REQ_DEV_TYPE
+};
+#define DINFO_NUM_REQ	(sizeof dinfo_req / sizeof *dinfo_req)
+
+/* Sends all the requests needed for the device descriptor in one go. The
+ * responses are collected later by dev_collect.
+ */
+static void dev_prefetch(struct spnav_ctx *ctx)
+{
+	int i;
+	struct reqresp rr[DINFO_NUM_REQ];
+
+	memset(rr, 0, sizeof rr);
+	for(i=0; i<DINFO_NUM_REQ; i++) {
+		rr[i].type = REQ_TAG | dinfo_req[i];
+	}
+	if(write(ctx->sock, rr, sizeof rr) == sizeof rr) {
+		ctx->dinfo_state = DINFO_PENDING;
+	}
+}
+
+static void dev_free_info(struct spnav_ctx *ctx)
+{
+	free(ctx->dinfo.name);
+	free(ctx->dinfo.path);
+	ctx->dinfo.name = ctx->dinfo.path = 0;
+}
+
+/* Collects the responses to the requests sent by dev_prefetch, into the
+ * device descriptor. Returns 0 on success, -1 if the daemon didn't respond.
+ */
+static int dev_collect(struct spnav_ctx *ctx)
+{
+	int i, req, res;
+	struct reqresp rr;
+	struct reqresp_strbuf sbuf = {0};
+	struct devinfo *di = &ctx->dinfo;
+
+	ctx->dinfo_state = DINFO_NONE;
+	dev_free_info(ctx);
+	di->naxes = di->nbuttons = di->type = -1;
+	di->usb = 0;
+
+	for(i=0; i<DINFO_NUM_REQ; i++) {
+		req = dinfo_req[i];
+		do {
+			if(wait_resp(ctx, &rr, sizeof rr, TIMEOUT) == -1) {
+				return -1;
+			}
+		} while(rr.type != (REQ_TAG | req));
+
+		switch(req) {
+		case REQ_DEV_NAME:
+		case REQ_DEV_PATH:
+			while((res = spnav_recv_str(&sbuf, &rr)) == 0) {
+				if(wait_resp(ctx, &rr, sizeof rr, TIMEOUT) == -1) {
+					free(sbuf.buf);
+					return -1;
+				}
+			}
+			if(res > 0) {
+				if(req == REQ_DEV_NAME) {
+					di->name = sbuf.buf;
+				} else {
+					di->path = sbuf.buf;
+				}
+				sbuf.buf = 0;
+			}
+			break;
+
+		case REQ_DEV_NAXES:
+			if(rr.data[6] >= 0) di->naxes = rr.data[0];
+			break;
+
+		case REQ_DEV_NBUTTONS:
+			if(rr.data[6] >= 0) di->nbuttons = rr.data[0];
+			break;
+
+		case REQ_DEV_USBID:
+			if(rr.data[6] >= 0) {
+				di->usbid[0] = rr.data[0];
+				di->usbid[1] = rr.data[1];
+				di->usb = 1;
+			}
+			break;
+
+		case REQ_DEV_TYPE:
+			if(rr.data[6] >= 0) di->type = rr.data[0];
+			break;
+		}
+	}
+	free(sbuf.buf);
+
+	ctx->dinfo_state = DINFO_VALID;
+	return 0;
+}
+
+/* Makes sure the device descriptor is up to date, fetching it if necessary.
+ * Returns 0 on success, -1 on failure.
+ */
+static int dev_info(struct spnav_ctx *ctx)
+{
+	if(ctx->sock == -1 || ctx->proto < 1) {
+		return -1;
+	}
+
+	if(ctx->dinfo_state == DINFO_PENDING) {
+		dev_collect(ctx);
+	}
+	if(ATOMIC_LOAD(ctx->dinfo_stale)) {
+		ATOMIC_STORE(ctx->dinfo_stale, 0);
+		ctx->dinfo_state = DINFO_NONE;
+	}
+	if(ctx->dinfo_state == DINFO_NONE) {
+		flush_resp(ctx);
+		dev_prefetch(ctx);
+		if(ctx->dinfo_state == DINFO_PENDING) {
+			dev_collect(ctx);
+		}
+	}
+	return ctx->dinfo_state == DINFO_VALID ? 0 : -1;
+}
+
+/* Copies a device descriptor string to buf, the same way request_str does */
+static int dev_info_str(const char *str, char *buf, int bufsz)
+{
+	if(!str) return -1;
+
+	if(buf) {
+		strncpy(buf, str, bufsz - 1);
+		buf[bufsz - 1] = 0;
+	}
+	return strlen(str);
+}
+
+/* Adds the device the daemon answers queries for to the device table, the
+ * first time the table is needed. The daemon doesn't announce devices which
+ * were already present when we connected.
+ */
+static void seed_devices(struct spnav_ctx *ctx)
+{
+	int type, idx;
+	unsigned int usbid[2] = {0, 0};
+
+	if(ctx->devs_seeded) return;
+	ctx->devs_seeded = 1;
+
+	if(dev_info(ctx) == -1 || ctx->dinfo.type == -1) {
+		return;		/* no device */
+	}
+	type = ctx->dinfo.type;
+	if(ctx->dinfo.usb) {
+		usbid[0] = ctx->dinfo.usbid[0];
+		usbid[1] = ctx->dinfo.usbid[1];
+	}
+
+	DEV_LOCK(ctx);
+	if((idx = find_device(ctx, -1, type, usbid)) == -1 && ctx->num_devs < MAX_DEVICES) {
+		/* keep it first, so that it's selected by default */
+		memmove(ctx->devs + 1, ctx->devs, ctx->num_devs * sizeof *ctx->devs);
+		ctx->num_devs++;
+		ctx->devs[0].id = -1;
+		ctx->devs[0].type = type;
+		ctx->devs[0].usbid[0] = usbid[0];
+		ctx->devs[0].usbid[1] = usbid[1];
+		idx = 0;
+	}
+	if(idx >= 0) {
+		ctx->devs[idx].remote = 1;
+	}
+	DEV_UNLOCK(ctx);
+}
+
+/* Returns a copy of the selected device in dev, and 1 if it's the one the
+ * daemon answers device queries for (or if there is no device table), 0 if
+ * only the client-side information is available.
+ */
+static int selected_device(struct spnav_ctx *ctx, struct device *dev)
+{
+	int res = 1;
+
+	if(ctx->proto < 1) return 1;
+	seed_devices(ctx);
+
+	DEV_LOCK(ctx);
+	if(ctx->sel_dev < ctx->num_devs) {
+		*dev = ctx->devs[ctx->sel_dev];
+		res = dev->remote;
+	}
+	DEV_UNLOCK(ctx);
+	return res;
+}
+
+int spnav_ctx_num_devices(spnav_ctx *ctx)
+{
+	int res;
+
+	if(ctx->sock == -1 || ctx->proto < 1) {
+		return -1;
+	}
+	seed_devices(ctx);
+
+	DEV_LOCK(ctx);
+	res = ctx->num_devs;
+	DEV_UNLOCK(ctx);
+	return res;
+}
+
+int spnav_ctx_select_device(spnav_ctx *ctx, int dev)
+{
+	int res = -1;
+
+	if(spnav_ctx_num_devices(ctx) == -1) {
+		return -1;
+	}
+
+	DEV_LOCK(ctx);
+	if(dev >= 0 && dev < ctx->num_devs) {
+		ctx->sel_dev = dev;
+		res = 0;
+	}
+	DEV_UNLOCK(ctx);
+	return res;
+}
+
+int spnav_ctx_dev_id(spnav_ctx *ctx)
+{
+	struct device dev;
+
+	dev.id = -1;
+	selected_device(ctx, &dev);
+	return dev.id;
+}
+
+int spnav_ctx_dev_name(spnav_ctx *ctx, char *buf, int bufsz)
+{
+	struct device dev;
+
+	if(!selected_device(ctx, &dev) || dev_info(ctx) == -1) {
+		return -1;
+	}
+	return dev_info_str(ctx->dinfo.name, buf, bufsz);
+}
+
+int spnav_ctx_dev_path(spnav_ctx *ctx, char *buf, int bufsz)
+{
+	struct device dev;
+
+	if(!selected_device(ctx, &dev) || dev_info(ctx) == -1) {
+		return -1;
+	}
+	return dev_info_str(ctx->dinfo.path, buf, bufsz);
+}
+
+int spnav_ctx_dev_buttons(spnav_ctx *ctx)
+{
+	struct device dev;
+	if(!selected_device(ctx, &dev) || dev_info(ctx) == -1 || ctx->dinfo.nbuttons == -1) {
+		return 2;	/* default */
+	}
+	return ctx->dinfo.nbuttons;
+}
+
+int spnav_ctx_dev_axes(spnav_ctx *ctx)
+{
+	struct device dev;
+	if(!selected_device(ctx, &dev) || dev_info(ctx) == -1 || ctx->dinfo.naxes == -1) {
+		return 6;	/* default */
+	}
+	return ctx->dinfo.naxes;
+}
+
+int spnav_ctx_dev_usbid(spnav_ctx *ctx, unsigned int *vend, unsigned int *prod)
+{
+	struct device dev;
+
+	if(!selected_device(ctx, &dev)) {
+		if(!dev.usbid[0] && !dev.usbid[1]) {
+			return -1;	/* not a USB device */
+		}
+		if(vend) *vend = dev.usbid[0];
+		if(prod) *prod = dev.usbid[1];
+		return 0;
+	}
+	if(dev_info(ctx) == -1 || !ctx->dinfo.usb) {
+		return -1;
+	}
+	if(vend) *vend = ctx->dinfo.usbid[0];
+	if(prod) *prod = ctx->dinfo.usbid[1];
+	return 0;
+}
+
+int spnav_ctx_dev_type(spnav_ctx *ctx)
+{
+	struct device dev;
+
+	if(!selected_device(ctx, &dev)) {
+		return dev.type;
+	}
+	if(dev_info(ctx) == -1) {
+		return -1;
+	}
+	return ctx->dinfo.type;
+}
+
+
+/* Returns the per-axis/per-button table of the config cache used for the
+ * REQ_GCFG_* request req, or -1 if it's not a table.
+ */
+static int cfg_table(int req)
+{
+	switch(req) {
+	case REQ_GCFG_DEADZONE:
+		return CFG_TAB_DEADZONE;
+	case REQ_GCFG_AXISMAP:
+		return CFG_TAB_AXISMAP;
+	case REQ_GCFG_BNMAP:
+		return CFG_TAB_BNMAP;
+	case REQ_GCFG_BNACTION:
+		return CFG_TAB_BNACTION;
+	case REQ_GCFG_KBMAP:
+		return CFG_TAB_KBMAP;
+	default:
+		break;
+	}
+	return -1;
+}
+
+/* Returns non-zero if req is a cacheable config query. The serial device path
+ * is a string spanning multiple responses, so it's not cached.
+ */
+static int cfg_cacheable(int req)
+{
+	return req >= REQ_GCFG_SENS && req <= REQ_GCFG_REPEAT && ((req - REQ_GCFG_SENS) & 1) == 0 &&
+		req != REQ_GCFG_SERDEV;
+}
+
+/* Enables config change events the first time the cache is used, which are
+ * needed to keep it coherent. Returns non-zero if the cache can be used.
+ */
+static int cfg_cache_enable(struct spnav_ctx *ctx)
+{
+	struct reqresp rr = {0};
+
+	if(!ctx->cfgc_state) {
+		ctx->cfgc_state = -1;	/* also keeps request from recursing */
+		rr.data[0] = ctx->evmask | SPNAV_EVMASK_CFG;
+		if(request(ctx, REQ_SET_EVMASK, &rr, TIMEOUT) != -1) {
+			ctx->cfgc_state = 1;
+		}
+	}
+	return ctx->cfgc_state > 0;
+}
+
+/* Picks up any config change events the application hasn't read yet, so that
+ * the cache doesn't return values they supersede. The reader thread decodes
+ * them as they arrive, so there's nothing to do while it's running. Otherwise
+ * the packets already buffered are demultiplexed, and more are read only if
+ * rx_pending says there's something to read. Responses found on the way are
+ * stashed, not discarded.
+ */
+static void cfg_cache_sync(struct spnav_ctx *ctx)
+{
+	int32_t *pkt;
+
+#ifdef SPNAV_USE_THREADS
+	if(ctx->thr_running) return;
+#endif
+
+	for(;;) {
+		while((pkt = rx_demux(ctx))) {
+			stash_resp(ctx, pkt);
+		}
+		if(!rx_pending(ctx)) {
+			break;
+		}
+		if(rx_fill(ctx, 0, 0) <= 0) {
+			break;
+		}
+	}
+}
+
+/* Looks up the response to the config query req in the cache. For table
+ * queries, the index is taken from rr->data[0]. Returns 0 and fills in rr on
+ * a cache hit, or -1 otherwise.
+ */
+static int cfg_cache_get(struct spnav_ctx *ctx, int req, struct reqresp *rr)
+{
+	int tab, idx, res = -1;
+	struct cfg_cache *cc = &ctx->cfgc;
+
+	req &= 0xffff;
+	if(!cfg_cacheable(req) || !cfg_cache_enable(ctx)) {
+		return -1;
+	}
+	cfg_cache_sync(ctx);
+
+	CFG_LOCK(ctx);
+	if((tab = cfg_table(req)) >= 0) {
+		idx = rr->data[0];
+		if(idx >= 0 && idx < CFG_TABLE_SIZE && cc->tab_valid[tab][idx]) {
+			rr->data[1] = cc->tab[tab][idx];
+			res = 0;
+		}
+	} else if(cc->valid & (1 << CFG_SLOT(req))) {
+		memcpy(rr->data, cc->val[CFG_SLOT(req)], sizeof cc->val[0]);
+		res = 0;
+	}
+	CFG_UNLOCK(ctx);
+
+	if(res == 0) {
+		rr->type = REQ_TAG | req;
+		rr->data[6] = 0;
+	}
+	return res;
+}
+
+/* Stores a config value from a query response, or an event, in the cache */
+static void cfg_cache_store(struct spnav_ctx *ctx, int req, const int *data)
+{
+	int tab, idx;
+	struct cfg_cache *cc = &ctx->cfgc;
+
+	if((tab = cfg_table(req)) >= 0) {
+		idx = data[0];
+		if(idx >= 0 && idx < CFG_TABLE_SIZE) {
+			cc->tab[tab][idx] = data[1];
+			cc->tab_valid[tab][idx] = 1;
+		}
+	} else {
+		memcpy(cc->val[CFG_SLOT(req)], data, sizeof cc->val[0]);
+		cc->valid |= 1 << CFG_SLOT(req);
+	}
+}
+
+/* Updates the cache after a successful request. Query responses are cached,
+ * unless a config change event arrived since gen was sampled, in which case
+ * they might be out of date already. Set requests invalidate the
+ * corresponding entry, and resetting or reloading the configuration
+ * invalidates everything.
+ */
+static void cfg_cache_update(struct spnav_ctx *ctx, int req, const struct reqresp *rr,
+		unsigned int gen)
+{
+	int tab, idx;
+	struct cfg_cache *cc = &ctx->cfgc;
+
+	if(ctx->cfgc_state <= 0) return;
+
+	CFG_LOCK(ctx);
+	if(req == REQ_CFG_RESET || req == REQ_CFG_RESTORE) {
+		memset(cc, 0, sizeof *cc);
+
+	} else if(cfg_cacheable(req + 1)) {
+		/* set request: invalidate, and let the next query fetch the new value */
+		req++;
+		if((tab = cfg_table(req)) >= 0) {
+			idx = rr->data[0];
+			if(idx >= 0 && idx < CFG_TABLE_SIZE) {
+				cc->tab_valid[tab][idx] = 0;
+			}
+		} else {
+			cc->valid &= ~(1 << CFG_SLOT(req));
+		}
+
+	} else if(cfg_cacheable(req) && gen == ctx->cfgc_gen) {
+		cfg_cache_store(ctx, req, rr->data);
+	}
+	CFG_UNLOCK(ctx);
+}
+
+/* Applies a configuration change event to the cache */
+static void cfg_cache_event(struct spnav_ctx *ctx, const struct spnav_event_cfg *ev)
+{
+	CFG_LOCK(ctx);
+	ATOMIC_STORE(ctx->cfgc_gen, ctx->cfgc_gen + 1);
+	if(cfg_cacheable(ev->cfg)) {
+		cfg_cache_store(ctx, ev->cfg, ev->data);
+	}
+	CFG_UNLOCK(ctx);
+}
+
+/* configuation api */
+
+/* config set requests which can be batched by spnav_cfg_begin */
+static int cfg_batchable(int req)
+{
+	if(req >= REQ_SCFG_SENS && req <= REQ_GCFG_REPEAT) {
+		return !(req & 1) && req != REQ_SCFG_SERDEV;
+	}
+	return req >= REQ_CFG_SAVE && req <= REQ_CFG_RESET;
+}
+
+/* Queues a set request for the next spnav_cfg_commit */
+static int cfg_batch_add(struct spnav_ctx *ctx, int req, const struct reqresp *rr)
+{
+	int newsz;
+	struct reqresp *tmp;
+
+	if(ctx->cfgb_count >= ctx->cfgb_size) {
+		newsz = ctx->cfgb_size ? ctx->cfgb_size * 2 : MAX_PIPELINE;
+		if(!(tmp = realloc(ctx->cfgb, newsz * sizeof *tmp))) {
+			return -1;
+		}
+		ctx->cfgb = tmp;
+		ctx->cfgb_size = newsz;
+	}
+	tmp = ctx->cfgb + ctx->cfgb_count++;
+	memcpy(tmp->data, rr->data, sizeof tmp->data);
+	tmp->type = REQ_TAG | req;
+	return 0;
+}
+
+int spnav_ctx_cfg_begin(spnav_ctx *ctx)
+{
+	if(ctx->sock < 0 || ctx->proto < 1 || ctx->cfgb_active) {
+		return -1;
+	}
+	ctx->cfgb_active = 1;
+	ctx->cfgb_count = 0;
+	return 0;
+}
+
+int spnav_ctx_cfg_commit(spnav_ctx *ctx, int *status, int max)
+{
+	int i, j, n, count, res = 0;
+	unsigned int gen;
+	struct reqresp rr, *req;
+
+	if(!ctx->cfgb_active) return -1;
+
+	ctx->cfgb_active = 0;
+	count = ctx->cfgb_count;
+	ctx->cfgb_count = 0;
+
+	if(!count) return 0;
+	if(ctx->sock < 0) return -1;
+
+	gen = ATOMIC_LOAD(ctx->cfgc_gen);
+	flush_resp(ctx);
+
+	/* send the queued requests in bursts, and collect the responses of each
+	 * burst before sending the next, to avoid filling up the socket buffers
+	 * in both directions
+	 */
+	for(i=0; i<count; i+=n) {
+		n = count - i > MAX_PIPELINE ? MAX_PIPELINE : count - i;
+		req = ctx->cfgb + i;
+
+		if(write(ctx->sock, req, n * sizeof *req) != n * sizeof *req) {
+			j = 0;
+			goto fail;
+		}
+		for(j=0; j<n; j++) {
+			do {
+				if(wait_resp(ctx, &rr, sizeof rr, TIMEOUT) == -1) {
+					goto fail;
+				}
+			} while(rr.type != req[j].type);
+
+			if(rr.data[6] < 0) {
+				res++;
+			} else {
+				/* the request has the table index for invalidating the cache */
+				cfg_cache_update(ctx, req[j].type & 0xffff, req + j, gen);
+			}
+			if(i + j < max) {
+				status[i + j] = rr.data[6] < 0 ? -1 : 0;
+			}
+		}
+	}
+	return res;
+
+fail:
+	/* whatever didn't get a response, is unknown */
+	for(i=i+j; i<count && i<max; i++) {
+		status[i] = -1;
+	}
+	return -1;
+}
+
+int spnav_ctx_cfg_reset(spnav_ctx *ctx)
+{
+	struct reqresp rr = {0};
+	return request(ctx, REQ_CFG_RESET, &rr, TIMEOUT);
+}
+
+int spnav_ctx_cfg_restore(spnav_ctx *ctx)
+{
+	struct reqresp rr = {0};
+	return request(ctx, REQ_CFG_RESTORE, &rr, TIMEOUT);
+}
+
+int spnav_ctx_cfg_save(spnav_ctx *ctx)
+{
+	struct reqresp rr = {0};
+	return request(ctx, REQ_CFG_SAVE, &rr, TIMEOUT);
+}
+
+int spnav_ctx_cfg_set_sens(spnav_ctx *ctx, float s)
+{
+	struct reqresp rr = {0};
+	rr.data[0] = *(int*)&s;
+	return request(ctx, REQ_SCFG_SENS, &rr, TIMEOUT);
+}
+
+float spnav_ctx_cfg_get_sens(spnav_ctx *ctx)
+{
+	struct reqresp rr = {0};
+	if(request(ctx, REQ_GCFG_SENS, &rr, TIMEOUT) == -1) {
+		return -1.0f;
+	}
+	return *(float*)&rr.data[0];
+}
+
+int spnav_ctx_cfg_set_axis_sens(spnav_ctx *ctx, const float *svec)
+{
+	struct reqresp rr;
+	memcpy(rr.data, svec, 6 * sizeof *svec);
+	return request(ctx, REQ_SCFG_SENS_AXIS, &rr, TIMEOUT);
+}
+
+int spnav_ctx_cfg_get_axis_sens(spnav_ctx *ctx, float *svec)
+{
+	struct reqresp rr = {0};
+
+	if(request(ctx, REQ_GCFG_SENS_AXIS, &rr, TIMEOUT) == -1) {
+		return -1;
+	}
+	memcpy(svec, rr.data, 6 * sizeof *svec);
+	return 0;
+}
+
+int spnav_ctx_cfg_set_deadzone(spnav_ctx *ctx, int axis, int delta)
+{
+	struct reqresp rr = {0};
+
+	rr.data[0] = axis;
+	rr.data[1] = delta;
+	return request(ctx, REQ_SCFG_DEADZONE, &rr, TIMEOUT);
+}
+
+int spnav_ctx_cfg_get_deadzone(spnav_ctx *ctx, int axis)
+{
+	struct reqresp rr = {0};
+
+	rr.data[0] = axis;
+	if(request(ctx, REQ_GCFG_DEADZONE, &rr, TIMEOUT) == -1) {
+		return -1;
+	}
+	return rr.data[1];
+}
+
+int spnav_ctx_cfg_set_invert(spnav_ctx *ctx, int invbits)
+{
+	int i;
+	struct reqresp rr;
+
+	for(i=0; i<6; i++) {
+		rr.data[i] = invbits & 1;
+		invbits >>= 1;
+	}
+	return request(ctx, REQ_SCFG_INVERT, &rr, TIMEOUT);
+}
+
+int spnav_ctx_cfg_get_invert(spnav_ctx *ctx)
+{
+	int i, res = 0;
+	struct reqresp rr = {0};
+
+	if(request(ctx, REQ_GCFG_INVERT, &rr, TIMEOUT) == -1) {
+		return -1;
+	}
+	for(i=0; i<6; i++) {
+		res = (res >> 1) | (rr.data[i] ? 0x20 : 0);
+	}
+	return res;
+}
+
+int spnav_ctx_cfg_set_axismap(spnav_ctx *ctx, int devaxis, int map)
+{
+	struct reqresp rr = {0};
+
+	rr.data[0] = devaxis;
+	rr.data[1] = map;
+	return request(ctx, REQ_SCFG_AXISMAP, &rr, TIMEOUT);
+}
+
+int spnav_ctx_cfg_get_axismap(spnav_ctx *ctx, int devaxis)
+{
+	struct reqresp rr = {0};
+
+	rr.data[0] = devaxis;
+	if(request(ctx, REQ_GCFG_AXISMAP, &rr, TIMEOUT) == -1) {
+		return -1;
+	}
+	return rr.data[1];
+}
+
+int spnav_ctx_cfg_set_bnmap(spnav_ctx *ctx, int devbn, int map)
+{
+	struct reqresp rr = {0};
+
+	rr.data[0] = devbn;
+	rr.data[1] = map;
+	return request(ctx, REQ_SCFG_BNMAP, &rr, TIMEOUT);
+}
+
+int spnav_ctx_cfg_get_bnmap(spnav_ctx *ctx, int devbn)
+{
+	struct reqresp rr = {0};
+
+	rr.data[0] = devbn;
+	if(request(ctx, REQ_GCFG_BNMAP, &rr, TIMEOUT) == -1) {
+		return -1;
+	}
+	return rr.data[1];
+}
+
+int spnav_ctx_cfg_set_bnaction(spnav_ctx *ctx, int bn, int act)
+{
+	struct reqresp rr = {0};
+
+	rr.data[0] = bn;
+	rr.data[1] = act;
+	return request(ctx, REQ_SCFG_BNACTION, &rr, TIMEOUT);
+}
+
+int spnav_ctx_cfg_get_bnaction(spnav_ctx *ctx, int bn)
+{
+	struct reqresp rr = {0};
+
+	rr.data[0] = bn;
+	if(request(ctx, REQ_GCFG_BNACTION, &rr, TIMEOUT) == -1) {
+		return -1;
+	}
+	return rr.data[1];
+}
+
+int spnav_ctx_cfg_set_kbmap(spnav_ctx *ctx, int bn, int key)
+{
+	struct reqresp rr = {0};
+
+	rr.data[0] = bn;
+	rr.data[1] = key;
+	return request(ctx, REQ_SCFG_KBMAP, &rr, TIMEOUT);
+}
+
+int spnav_ctx_cfg_get_kbmap(spnav_ctx *ctx, int bn)
+{
+	struct reqresp rr = {0};
+
+	rr.data[0] = bn;
+	if(request(ctx, REQ_GCFG_KBMAP, &rr, TIMEOUT) == -1) {
+		return -1;
+	}
+	return rr.data[1];
+}
+
+int spnav_ctx_cfg_set_deadzones(spnav_ctx *ctx, int first, int count, const int *delta)
+{
+	return request_table(ctx, REQ_SCFG_DEADZONE, first, count, delta, 0, TIMEOUT);
+}
+
+int spnav_ctx_cfg_get_deadzones(spnav_ctx *ctx, int first, int count, int *delta)
+{
+	return request_table(ctx, REQ_GCFG_DEADZONE, first, count, 0, delta, TIMEOUT);
+}
+
+int spnav_ctx_cfg_set_axismaps(spnav_ctx *ctx, int first, int count, const int *map)
+{
+	return request_table(ctx, REQ_SCFG_AXISMAP, first, count, map, 0, TIMEOUT);
+}
+
+int spnav_ctx_cfg_get_axismaps(spnav_ctx *ctx, int first, int count, int *map)
+{
+	return request_table(ctx, REQ_GCFG_AXISMAP, first, count, 0, map, TIMEOUT);
+}
+
+int spnav_ctx_cfg_set_bnmaps(spnav_ctx *ctx, int first, int count, const int *map)
+{
+	return request_table(ctx, REQ_SCFG_BNMAP, first, count, map, 0, TIMEOUT);
+}
+
+int spnav_ctx_cfg_get_bnmaps(spnav_ctx *ctx, int first, int count, int *map)
+{
+	return request_table(ctx, REQ_GCFG_BNMAP, first, count, 0, map, TIMEOUT);
+}
+
+int spnav_ctx_cfg_set_bnactions(spnav_ctx *ctx, int first, int count, const int *act)
+{
+	return request_table(ctx, REQ_SCFG_BNACTION, first, count, act, 0, TIMEOUT);
+}
+
+int spnav_ctx_cfg_get_bnactions(spnav_ctx *ctx, int first, int count, int *act)
+{
+	return request_table(ctx, REQ_GCFG_BNACTION, first, count, 0, act, TIMEOUT);
+}
+
+int spnav_ctx_cfg_set_kbmaps(spnav_ctx *ctx, int first, int count, const int *key)
+{
+	return request_table(ctx, REQ_SCFG_KBMAP, first, count, key, 0, TIMEOUT);
+}
+
+int spnav_ctx_cfg_get_kbmaps(spnav_ctx *ctx, int first, int count, int *key)
+{
+	return request_table(ctx, REQ_GCFG_KBMAP, first, count, 0, key, TIMEOUT);
+}
+
+int spnav_ctx_cfg_set_swapyz(spnav_ctx *ctx, int swap)
+{
+	struct reqresp rr = {0};
+
+	rr.data[0] = swap;
+	return request(ctx, REQ_SCFG_SWAPYZ, &rr, TIMEOUT);
+}
+
+int spnav_ctx_cfg_get_swapyz(spnav_ctx *ctx)
+{
+	struct reqresp rr = {0};
+
+	if(request(ctx, REQ_GCFG_SWAPYZ, &rr, TIMEOUT) == -1) {
+		return -1;
+	}
+	return rr.data[0];
+}
+
+int spnav_ctx_cfg_set_led(spnav_ctx *ctx, int state)
+{
+	struct reqresp rr = {0};
+
+	if(state < 0 || state >= 3) return -1;
+
+	rr.data[0] = state;
+	return request(ctx, REQ_SCFG_LED, &rr, TIMEOUT);
+}
+
+int spnav_ctx_cfg_get_led(spnav_ctx *ctx)
+{
+	struct reqresp rr = {0};
+
+	if(request(ctx, REQ_GCFG_LED, &rr, TIMEOUT) == -1) {
+		return -1;
+	}
+	return rr.data[0];
+}
+
+int spnav_ctx_cfg_set_grab(spnav_ctx *ctx, int state)
+{
+	struct reqresp rr = {0};
+
+	rr.data[0] = state ? 1 : 0;
+	return request(ctx, REQ_SCFG_GRAB, &rr, TIMEOUT);
+}
+
+int spnav_ctx_cfg_get_grab(spnav_ctx *ctx)
+{
+	struct reqresp rr = {0};
+
+	if(request(ctx, REQ_GCFG_GRAB, &rr, TIMEOUT) == -1) {
+		return -1;
+	}
+	return rr.data[0];
+}
+
+int spnav_ctx_cfg_set_serial(spnav_ctx *ctx, const char *devpath)
+{
+	return spnav_send_str(ctx->sock, REQ_SCFG_SERDEV, devpath);
+}
+
+int spnav_ctx_cfg_get_serial(spnav_ctx *ctx, char *buf, int bufsz)
+{
+	return request_str(ctx, REQ_GCFG_SERDEV, buf, bufsz, TIMEOUT);
+}
+
+int spnav_ctx_cfg_set_repeat(spnav_ctx *ctx, int msec)
+{
+	struct reqresp rr = {0};
+
+	if(msec < 0) msec = -1;
+
+	rr.data[0] = msec;
+	return request(ctx, REQ_SCFG_REPEAT, &rr, TIMEOUT);
+}
+
+int spnav_ctx_cfg_get_repeat(spnav_ctx *ctx)
+{
+	struct reqresp rr = {0};
+
+	if(request(ctx, REQ_GCFG_REPEAT, &rr, TIMEOUT) == -1) {
+		return -1;
+	}
+	return rr.data[0];
+}
+
+/* ---- configuration profiles ---- */
+
+/* Retrieves the settings selected by mask into prof. Settings which can't be
+ * retrieved are left out of prof->valid. The serial device path is not part of
+ * profiles, it's a machine-wide setting (see spnav.h).
+ */
+static void profile_get(struct spnav_ctx *ctx, struct spnav_profile *prof, unsigned int mask)
+{
+	int i, n;
+	struct reqresp rr;
+	static const struct {
+		int req;
+		unsigned int bit;
+		size_t offs;
+	} scalars[] = {
+		{REQ_GCFG_SENS, SPNAV_PROF_SENS, offsetof(struct spnav_profile, sens)},
+		{REQ_GCFG_SWAPYZ, SPNAV_PROF_SWAPYZ, offsetof(struct spnav_profile, swapyz)},
+		{REQ_GCFG_LED, SPNAV_PROF_LED, offsetof(struct spnav_profile, led)},
+		{REQ_GCFG_GRAB, SPNAV_PROF_GRAB, offsetof(struct spnav_profile, grab)},
+		{REQ_GCFG_REPEAT, SPNAV_PROF_REPEAT, offsetof(struct spnav_profile, repeat)}
+	};
+
+	memset(prof, 0, sizeof *prof);
+
+	for(i=0; i<sizeof scalars / sizeof *scalars; i++) {
+		if(!(mask & scalars[i].bit)) continue;
+
+		memset(&rr, 0, sizeof rr);
+		if(request(ctx, scalars[i].req, &rr, TIMEOUT) == 0) {
+			/* sens is a float, but it's passed around as an int bit pattern */
+			memcpy((char*)prof + scalars[i].offs, rr.data, sizeof(int32_t));
+			prof->valid |= scalars[i].bit;
+		}
+	}
+
+	if((mask & SPNAV_PROF_AXIS_SENS) && spnav_ctx_cfg_get_axis_sens(ctx, prof->axis_sens) == 0) {
+		prof->valid |= SPNAV_PROF_AXIS_SENS;
+	}
+	if((mask & SPNAV_PROF_INVERT) && (prof->invert = spnav_ctx_cfg_get_invert(ctx)) != -1) {
+		prof->valid |= SPNAV_PROF_INVERT;
+	}
+
+	if((n = spnav_ctx_dev_axes(ctx)) > 0) {
+		prof->naxes = n > SPNAV_PROF_MAX_AXES ? SPNAV_PROF_MAX_AXES : n;
+		if((mask & SPNAV_PROF_DEADZONE) &&
+				request_table(ctx, REQ_GCFG_DEADZONE, 0, prof->naxes, 0, prof->deadzone, TIMEOUT) == 0) {
+			prof->valid |= SPNAV_PROF_DEADZONE;
+		}
+		if((mask & SPNAV_PROF_AXISMAP) &&
+				request_table(ctx, REQ_GCFG_AXISMAP, 0, prof->naxes, 0, prof->axismap, TIMEOUT) == 0) {
+			prof->valid |= SPNAV_PROF_AXISMAP;
+		}
+	}
+	if((n = spnav_ctx_dev_buttons(ctx)) > 0) {
+		prof->nbuttons = n > SPNAV_PROF_MAX_BUTTONS ? SPNAV_PROF_MAX_BUTTONS : n;
+		if((mask & SPNAV_PROF_BNMAP) &&
+				request_table(ctx, REQ_GCFG_BNMAP, 0, prof->nbuttons, 0, prof->bnmap, TIMEOUT) == 0) {
+			prof->valid |= SPNAV_PROF_BNMAP;
+		}
+		if((mask & SPNAV_PROF_BNACTION) &&
+				request_table(ctx, REQ_GCFG_BNACTION, 0, prof->nbuttons, 0, prof->bnaction, TIMEOUT) == 0) {
+			prof->valid |= SPNAV_PROF_BNACTION;
+		}
+		if((mask & SPNAV_PROF_KBMAP) &&
+				request_table(ctx, REQ_GCFG_KBMAP, 0, prof->nbuttons, 0, prof->kbmap, TIMEOUT) == 0) {
+			prof->valid |= SPNAV_PROF_KBMAP;
+		}
+	}
+}
+
+int spnav_ctx_profile_capture(spnav_ctx *ctx, struct spnav_profile *prof)
+{
+	if(ctx->sock < 0 || ctx->proto < 1) return -1;
+
+	profile_get(ctx, prof, SPNAV_PROF_ALL);
+	return prof->valid ? 0 : -1;
+}
+
+/* Queues set requests for the entries of a profile table which differ from the
+ * current table. Returns the number of requests queued.
+ */
+static int profile_diff_table(struct spnav_ctx *ctx, int req, const int *tab, int count,
+		const int *curtab, int curcount)
+{
+	int i, res = 0;
+	struct reqresp rr = {0};
+
+	for(i=0; i<count; i++) {
+		if(i < curcount && tab[i] == curtab[i]) continue;
+
+		rr.data[0] = i;
+		rr.data[1] = tab[i];
+		if(cfg_batch_add(ctx, req, &rr) == -1) {
+			return -1;
+		}
+		res++;
+	}
+	return res;
+}
+
+int spnav_ctx_profile_apply(spnav_ctx *ctx, const struct spnav_profile *prof)
+{
+	int n, count = 0;
+	unsigned int mask = prof->valid;
+	struct spnav_profile cur;
+
+	if(ctx->sock < 0 || ctx->proto < 1 || ctx->cfgb_active) return -1;
+
+	/* the current configuration mostly comes out of the config cache */
+	profile_get(ctx, &cur, mask);
+
+	spnav_ctx_cfg_begin(ctx);
+
+	/* the set functions only queue requests here, so the only way they can
+	 * fail is if the setting is invalid, or we run out of memory
+	 */
+#define SET_CHANGED(bit, field, setexpr) \
+	do { \
+		if((mask & (bit)) && (!(cur.valid & (bit)) || \
+					memcmp(&cur.field, &prof->field, sizeof cur.field) != 0)) { \
+			if((setexpr) == -1) goto fail; \
+			count++; \
+		} \
+	} while(0)
+
+	SET_CHANGED(SPNAV_PROF_SENS, sens, spnav_ctx_cfg_set_sens(ctx, prof->sens));
+	SET_CHANGED(SPNAV_PROF_AXIS_SENS, axis_sens, spnav_ctx_cfg_set_axis_sens(ctx, prof->axis_sens));
+	SET_CHANGED(SPNAV_PROF_INVERT, invert, spnav_ctx_cfg_set_invert(ctx, prof->invert));
+	SET_CHANGED(SPNAV_PROF_SWAPYZ, swapyz, spnav_ctx_cfg_set_swapyz(ctx, prof->swapyz));
+	SET_CHANGED(SPNAV_PROF_LED, led, spnav_ctx_cfg_set_led(ctx, prof->led));
+	SET_CHANGED(SPNAV_PROF_GRAB, grab, spnav_ctx_cfg_set_grab(ctx, prof->grab));
+	SET_CHANGED(SPNAV_PROF_REPEAT, repeat, spnav_ctx_cfg_set_repeat(ctx, prof->repeat));
+#undef SET_CHANGED
+
+#define DIFF_TABLE(bit, req, field, num) \
+	do { \
+		if(mask & (bit)) { \
+			n = profile_diff_table(ctx, req, prof->field, prof->num, cur.field, \
+					cur.valid & (bit) ? cur.num : 0); \
+			if(n == -1) goto fail; \
+			count += n; \
+		} \
+	} while(0)
+
+	DIFF_TABLE(SPNAV_PROF_DEADZONE, REQ_SCFG_DEADZONE, deadzone, naxes);
+	DIFF_TABLE(SPNAV_PROF_AXISMAP, REQ_SCFG_AXISMAP, axismap, naxes);
+	DIFF_TABLE(SPNAV_PROF_BNMAP, REQ_SCFG_BNMAP, bnmap, nbuttons);
+	DIFF_TABLE(SPNAV_PROF_BNACTION, REQ_SCFG_BNACTION, bnaction, nbuttons);
+	DIFF_TABLE(SPNAV_PROF_KBMAP, REQ_SCFG_KBMAP, kbmap, nbuttons);
+#undef DIFF_TABLE
+
+	if(spnav_ctx_cfg_commit(ctx, 0, 0) != 0) {
+		return -1;
+	}
+	return count;
+
+fail:
+	/* discard the batch */
+	ctx->cfgb_active = ctx->cfgb_count = 0;
+	return -1;
+}
+
+/* Profile blobs start with a 4 byte signature (the last byte is the format
+ * version), followed by the valid mask, naxes and nbuttons. Then come the
+ * valid settings only, in the order of the SPNAV_PROF_* bits. Floats are
+ * stored as 32-bit little endian, and integers as zigzag-encoded LEB128
+ * variable length integers, so small values take a single byte.
+ */
+#define PROF_SIG		"SPF\001"
+#define PROF_SIG_LEN	4
+
+struct blob {
+	unsigned char *ptr;		/* null when only counting */
+	const unsigned char *rdptr, *end;
+	int size;
+};
+
+static void blob_put(struct blob *b, unsigned int c)
+{
+	if(b->ptr) {
+		*b->ptr++ = c;
+	}
+	b->size++;
+}
+
+static void blob_put_int(struct blob *b, int x)
+{
+	/* zigzag: 0, -1, 1, -2, 2 ... -> 0, 1, 2, 3, 4 ... */
+	unsigned int v = x < 0 ? ((~(unsigned int)x) << 1) | 1 : (unsigned int)x << 1;
+
+	while(v >= 0x80) {
+		blob_put(b, (v & 0x7f) | 0x80);
+		v >>= 7;
+	}
+	blob_put(b, v);
+}
+
+static void blob_put_float(struct blob *b, float f)
+{
+	int i;
+	uint32_t v;
+
+	memcpy(&v, &f, sizeof v);
+	for(i=0; i<4; i++) {
+		blob_put(b, v & 0xff);
+		v >>= 8;
+	}
+}
+
+static void blob_put_table(struct blob *b, const int *tab, int count)
+{
+	int i;
+	for(i=0; i<count; i++) {
+		blob_put_int(b, tab[i]);
+	}
+}
+
+static int blob_get(struct blob *b, unsigned int *c)
+{
+	if(b->rdptr >= b->end) return -1;
+	*c = *b->rdptr++;
+	return 0;
+}
+
+static int blob_get_int(struct blob *b, int *x)
+{
+	int shift = 0;
+	unsigned int c, v = 0;
+
+	do {
+		if(shift > 28 || blob_get(b, &c) == -1) {
+			return -1;
+		}
+		v |= (c & 0x7f) << shift;
+		shift += 7;
+	} while(c & 0x80);
+
+	*x = v & 1 ? (int)~(v >> 1) : (int)(v >> 1);
+	return 0;
+}
+
+static int blob_get_float(struct blob *b, float *f)
+{
 	int i;
+	unsigned int c;
+	uint32_t v = 0;
 
-	if(data[0] < 0 || data[0] >= MAX_UEV) {
-		return 0;
+	for(i=0; i<4; i++) {
+		if(blob_get(b, &c) == -1) return -1;
+		v |= (uint32_t)c << (i * 8);
 	}
+	memcpy(f, &v, sizeof v);
+	return 0;
+}
 
-	switch(data[0]) {
-	case UEV_MOTION:
-		event->type = SPNAV_EVENT_MOTION;
-		break;
-	case UEV_PRESS:
-	case UEV_RELEASE:
-		event->type = SPNAV_EVENT_BUTTON;
-		break;
-	default:
-		event->type = data[0];
+static int blob_get_table(struct blob *b, int *tab, int count)
+{
+	int i;
+	for(i=0; i<count; i++) {
+		if(blob_get_int(b, tab + i) == -1) return -1;
 	}
+	return 0;
+}
 
-	switch(event->type) {
-	case SPNAV_EVENT_MOTION:
-		event->motion.data = &event->motion.x;
-		for(i=0; i<6; i++) {
-			event->motion.data[i] = data[i + 1];
-		}
-		event->motion.period = data[7];
-		break;
-
-	case SPNAV_EVENT_RAWAXIS:
-		event->axis.idx = data[1];
-		event->axis.value = data[2];
-		break;
+static void profile_write(struct blob *b, const struct spnav_profile *prof)
+{
+	int i;
+	unsigned int mask = prof->valid & SPNAV_PROF_ALL;
 
-	case SPNAV_EVENT_BUTTON:
-		event->button.press = data[0] == UEV_PRESS ? 1 : 0;
-		event->button.bnum = data[1];
-		break;
+	for(i=0; i<PROF_SIG_LEN; i++) {
+		blob_put(b, (unsigned char)PROF_SIG[i]);
+	}
+	blob_put_int(b, mask);
+	blob_put_int(b, prof->naxes);
+	blob_put_int(b, prof->nbuttons);
 
-	case SPNAV_EVENT_RAWBUTTON:
-		event->button.bnum = data[1];
-		event->button.press = data[2];
-		break;
+	if(mask & SPNAV_PROF_SENS) {
+		blob_put_float(b, prof->sens);
+	}
+	if(mask & SPNAV_PROF_AXIS_SENS) {
+		for(i=0; i<6; i++) {
+			blob_put_float(b, prof->axis_sens[i]);
+		}
+	}
+	if(mask & SPNAV_PROF_INVERT) blob_put_int(b, prof->invert);
+	if(mask & SPNAV_PROF_SWAPYZ) blob_put_int(b, prof->swapyz);
+	if(mask & SPNAV_PROF_LED) blob_put_int(b, prof->led);
+	if(mask & SPNAV_PROF_GRAB) blob_put_int(b, prof->grab);
+	if(mask & SPNAV_PROF_REPEAT) blob_put_int(b, prof->repeat);
+
+	if(mask & SPNAV_PROF_DEADZONE) blob_put_table(b, prof->deadzone, prof->naxes);
+	if(mask & SPNAV_PROF_AXISMAP) blob_put_table(b, prof->axismap, prof->naxes);
+	if(mask & SPNAV_PROF_BNMAP) blob_put_table(b, prof->bnmap, prof->nbuttons);
+	if(mask & SPNAV_PROF_BNACTION) blob_put_table(b, prof->bnaction, prof->nbuttons);
+	if(mask & SPNAV_PROF_KBMAP) blob_put_table(b, prof->kbmap, prof->nbuttons);
+}
 
-	case SPNAV_EVENT_DEV:
-		event->dev.op = data[1];
-		event->dev.id = data[2];
-		event->dev.devtype = data[3];
-		event->dev.usbid[0] = data[4];
-		event->dev.usbid[1] = data[5];
-		break;
+int spnav_profile_save(const struct spnav_profile *prof, void *buf, int bufsz)
+{
+	struct blob b = {0};
 
-	case SPNAV_EVENT_CFG:
-		event->cfg.cfg = data[1];
-		memcpy(event->cfg.data, data + 2, sizeof event->cfg.data);
-		break;
+	if(prof->naxes < 0 || prof->naxes > SPNAV_PROF_MAX_AXES ||
+			prof->nbuttons < 0 || prof->nbuttons > SPNAV_PROF_MAX_BUTTONS) {
+		return -1;
 	}
 
-	return event->type;
+	profile_write(&b, prof);
+	if(buf && bufsz >= b.size) {
+		b.ptr = buf;
+		b.size = 0;
+		profile_write(&b, prof);
+	}
+	return b.size;
 }
 
-
-int spnav_wait_event(spnav_event *event)
+int spnav_profile_load(struct spnav_profile *prof, const void *buf, int size)
 {
-#ifdef SPNAV_USE_X11
-	if(dpy) {
-		for(;;) {
-			XEvent xev;
-			XNextEvent(dpy, &xev);
+	int i, mask;
+	struct blob b = {0};
+	struct spnav_profile tmp;
 
-			if(spnav_x11_event(&xev, event) > 0) {
-				return event->type;
-			}
-		}
+	if(size < PROF_SIG_LEN || memcmp(buf, PROF_SIG, PROF_SIG_LEN) != 0) {
+		return -1;
 	}
-#endif
+	b.rdptr = (const unsigned char*)buf + PROF_SIG_LEN;
+	b.end = (const unsigned char*)buf + size;
 
-	if(sock) {
-		if(read_event(sock, event) > 0) {
-			return event->type;
+	memset(&tmp, 0, sizeof tmp);
+	if(blob_get_int(&b, &mask) == -1 || (mask & ~SPNAV_PROF_ALL) ||
+			blob_get_int(&b, &tmp.naxes) == -1 || blob_get_int(&b, &tmp.nbuttons) == -1) {
+		return -1;
+	}
+	if(tmp.naxes < 0 || tmp.naxes > SPNAV_PROF_MAX_AXES ||
+			tmp.nbuttons < 0 || tmp.nbuttons > SPNAV_PROF_MAX_BUTTONS) {
+		return -1;
+	}
+	tmp.valid = mask;
+
+	if((mask & SPNAV_PROF_SENS) && blob_get_float(&b, &tmp.sens) == -1) {
+		return -1;
+	}
+	if(mask & SPNAV_PROF_AXIS_SENS) {
+		for(i=0; i<6; i++) {
+			if(blob_get_float(&b, tmp.axis_sens + i) == -1) return -1;
 		}
 	}
+	if((mask & SPNAV_PROF_INVERT) && blob_get_int(&b, &tmp.invert) == -1) return -1;
+	if((mask & SPNAV_PROF_SWAPYZ) && blob_get_int(&b, &tmp.swapyz) == -1) return -1;
+	if((mask & SPNAV_PROF_LED) && blob_get_int(&b, &tmp.led) == -1) return -1;
+	if((mask & SPNAV_PROF_GRAB) && blob_get_int(&b, &tmp.grab) == -1) return -1;
+	if((mask & SPNAV_PROF_REPEAT) && blob_get_int(&b, &tmp.repeat) == -1) return -1;
+
+	if((mask & SPNAV_PROF_DEADZONE) && blob_get_table(&b, tmp.deadzone, tmp.naxes) == -1) return -1;
+	if((mask & SPNAV_PROF_AXISMAP) && blob_get_table(&b, tmp.axismap, tmp.naxes) == -1) return -1;
+	if((mask & SPNAV_PROF_BNMAP) && blob_get_table(&b, tmp.bnmap, tmp.nbuttons) == -1) return -1;
+	if((mask & SPNAV_PROF_BNACTION) && blob_get_table(&b, tmp.bnaction, tmp.nbuttons) == -1) return -1;
+	if((mask & SPNAV_PROF_KBMAP) && blob_get_table(&b, tmp.kbmap, tmp.nbuttons) == -1) return -1;
+
+	*prof = tmp;
 	return 0;
 }
 
-int spnav_poll_event(spnav_event *event)
+
+/* Event logs (see spnav_record_start) start with a 4 byte signature (the last
+ * byte is the format version), followed by the time recording started, in
+ * seconds and nanoseconds. Then comes one record per event: the event packet
+ * type (UEV_*) in a byte, the time since the previous event (or the start) in
+ * microseconds, and a byte with a bit for each of the 7 packet fields which
+ * are not zero, followed by those fields. Motion event fields are stored as
+ * deltas from the previous motion event, so that the period, and axes which
+ * don't change, take no space, and the rest usually take a single byte.
+ * Integers are encoded like in profile blobs. Gaps between events too long for
+ * the time delta are covered by REC_SKIP records, holding a number of seconds.
+ */
+#define REC_SIG			"SPR\001"
+#define REC_SIG_LEN		4
+#define REC_SKIP		0xff
+/* longest gap stored as a time delta, in seconds */
+#define REC_MAX_GAP		1000
+/* enough for a skip record, and an event record with all 7 fields */
+#define REC_MAX_SIZE	64
+
+static void ts_add_usec(struct spnav_timestamp *ts, long usec)
 {
-#ifdef SPNAV_USE_X11
-	if(dpy) {
-		if(XPending(dpy)) {
-			XEvent xev;
-			XNextEvent(dpy, &xev);
+	ts->nsec += (usec % 1000000) * 1000;
+	ts->sec += usec / 1000000 + ts->nsec / 1000000000;
+	ts->nsec %= 1000000000;
+}
+
+/* Appends an event packet to the log being recorded. Called by proc_event,
+ * which might be running in the reader thread.
+ */
+static void rec_event(struct spnav_ctx *ctx, const int32_t *data)
+{
+	int i;
+	long dt;
+	unsigned int mask = 0;
+	int32_t val[7];
+	unsigned char buf[REC_MAX_SIZE];
+	struct blob b = {0};
+
+	REC_LOCK(ctx);
+	if(!ctx->rec_fp) {
+		REC_UNLOCK(ctx);
+		return;
+	}
+	b.ptr = buf;
+
+	if((dt = ctx->rx_time.sec - ctx->rec_time.sec) > REC_MAX_GAP) {
+		blob_put(&b, REC_SKIP);
+		blob_put_int(&b, dt - 1);
+		ctx->rec_time.sec += dt - 1;
+	}
+	dt = (ctx->rx_time.sec - ctx->rec_time.sec) * 1000000 +
+		(ctx->rx_time.nsec - ctx->rec_time.nsec) / 1000;
+	if(dt < 0) {
+		dt = 0;		/* events received before recording started */
+	}
+	/* keep the time as it will be reconstructed, so that rounding errors
+	 * don't accumulate
+	 */
+	ts_add_usec(&ctx->rec_time, dt);
 
-			return spnav_x11_event(&xev, event);
+	for(i=0; i<7; i++) {
+		val[i] = data[i + 1];
+		if(data[0] == UEV_MOTION) {
+			val[i] = (int32_t)((uint32_t)data[i + 1] - (uint32_t)ctx->rec_motion[i]);
+			ctx->rec_motion[i] = data[i + 1];
+		}
+		if(val[i]) {
+			mask |= 1 << i;
 		}
-		return 0;
 	}
-#endif
 
-	if(sock) {
-		if(event_pending(sock)) {
-			if(read_event(sock, event) > 0) {
-				return event->type;
-			}
+	blob_put(&b, data[0]);
+	blob_put_int(&b, dt);
+	blob_put(&b, mask);
+	for(i=0; i<7; i++) {
+		if(mask & (1 << i)) {
+			blob_put_int(&b, val[i]);
 		}
 	}
-	return 0;
+
+	if(fwrite(buf, 1, b.size, ctx->rec_fp) != (size_t)b.size) {
+		ctx->rec_err = 1;
+	}
+	REC_UNLOCK(ctx);
 }
 
-#ifdef SPNAV_USE_X11
-static Bool match_events(Display *dpy, XEvent *xev, char *arg)
+static int rec_stop(struct spnav_ctx *ctx)
 {
-	int evtype = *(int*)arg;
-
-	if(xev->type != ClientMessage) {
-		return False;
-	}
+	int res = -1;
 
-	if(xev->xclient.message_type == motion_event) {
-		return !evtype || evtype == SPNAV_EVENT_MOTION ? True : False;
-	}
-	if(xev->xclient.message_type == button_press_event ||
-			xev->xclient.message_type == button_release_event) {
-		return !evtype || evtype == SPNAV_EVENT_BUTTON ? True : False;
+	REC_LOCK(ctx);
+	if(ctx->rec_fp) {
+		res = fclose(ctx->rec_fp) == 0 && !ctx->rec_err ? 0 : -1;
+		ATOMIC_STORE(ctx->rec_fp, 0);
 	}
-	return False;
+	REC_UNLOCK(ctx);
+	return res;
 }
-#endif
 
-/* Appends an event to an event list.
- * Tailptr must be a pointer to the tail pointer of the list. NULL means
- * append to the global event queue.
- */
-static int enqueue_event(spnav_event *event, struct event_node **tailptr)
+int spnav_ctx_record_start(spnav_ctx *ctx, const char *path)
 {
-	struct event_node *node;
-	if(!(node = malloc(sizeof *node))) {
+	int i;
+	FILE *fp;
+	unsigned char buf[REC_SIG_LEN + 10];
+	struct blob b = {0};
+
+	if(ctx->sock == -1 || ctx->rec_fp) {
+		return -1;
+	}
+	if(!(fp = fopen(path, "wb"))) {
 		return -1;
 	}
 
-	node->event = *event;
-	node->next = 0;
+	REC_LOCK(ctx);
+	get_time(&ctx->rec_time);
+	memset(ctx->rec_motion, 0, sizeof ctx->rec_motion);
+	ctx->rec_err = 0;
 
-	if(!tailptr) {
-		tailptr = &ev_queue_tail;
+	b.ptr = buf;
+	for(i=0; i<REC_SIG_LEN; i++) {
+		blob_put(&b, (unsigned char)REC_SIG[i]);
 	}
+	blob_put_int(&b, ctx->rec_time.sec);
+	blob_put_int(&b, ctx->rec_time.nsec);
 
-	(*tailptr)->next = node;
-	*tailptr = node;
+	if(fwrite(buf, 1, b.size, fp) != (size_t)b.size) {
+		REC_UNLOCK(ctx);
+		fclose(fp);
+		return -1;
+	}
+	ATOMIC_STORE(ctx->rec_fp, fp);
+	REC_UNLOCK(ctx);
 	return 0;
 }
 
-int spnav_remove_events(int type)
+int spnav_ctx_record_stop(spnav_ctx *ctx)
 {
-	int rm_count = 0;
-
-#ifdef SPNAV_USE_X11
-	if(dpy) {
-		XEvent xev;
+	return rec_stop(ctx);
+}
 
-		while(XCheckIfEvent(dpy, &xev, match_events, (char*)&type)) {
-			rm_count++;
-		}
-		return rm_count;
-	}
-#endif
+/* Decodes the next event record of the log being replayed into rp_pkt, and
+ * sets rp_time to its recorded time. Returns 0 on success, or -1 at the end of
+ * the log, or if the rest of it is corrupt.
+ */
+static int replay_decode(struct spnav_ctx *ctx)
+{
+	int i, dt, val;
+	unsigned int type, mask;
+	struct blob b = {0};
 
-	if(sock) {
-		struct event_node *tmplist, *tmptail;
+	b.rdptr = ctx->rp_data + ctx->rp_pos;
+	b.end = ctx->rp_data + ctx->rp_size;
 
-		if(!(tmplist = tmptail = malloc(sizeof *tmplist))) {
-			return -1;
-		}
-		tmplist->next = 0;
+	for(;;) {
+		if(blob_get(&b, &type) == -1) goto end;
+		if(type != REC_SKIP) break;
 
-		/* while there are events in the event queue, or the daemon socket */
-		while(event_pending(sock)) {
-			spnav_event event;
+		if(blob_get_int(&b, &dt) == -1 || dt < 0) goto end;
+		ctx->rp_time.sec += dt;
+	}
+	if(type >= MAX_UEV || blob_get_int(&b, &dt) == -1 || dt < 0 || blob_get(&b, &mask) == -1) {
+		goto end;
+	}
 
-			read_event(sock, &event);	/* remove next event */
-			if(event.type != type) {
-				/* We don't want to drop this one, wrong type. Keep the event
-				 * in the temporary list, for deferred reinsertion
-				 */
-				enqueue_event(&event, &tmptail);
-			} else {
-				rm_count++;
-			}
+	ctx->rp_pkt[0] = type;
+	for(i=0; i<7; i++) {
+		val = 0;
+		if((mask & (1 << i)) && blob_get_int(&b, &val) == -1) {
+			goto end;
 		}
+		if(type == UEV_MOTION) {
+			val = (int32_t)((uint32_t)ctx->rp_motion[i] + (uint32_t)val);
+			ctx->rp_motion[i] = val;
+		}
+		ctx->rp_pkt[i + 1] = val;
+	}
 
-		/* reinsert any events we removed that we didn't mean to */
-		while(tmplist->next) {
-			struct event_node *node = tmplist->next;
+	ts_add_usec(&ctx->rp_time, dt);
+	ctx->rp_pos = b.rdptr - ctx->rp_data;
+	ctx->rp_have = 1;
+	return 0;
 
-			enqueue_event(&node->event, 0);
+end:
+	ctx->rp_pos = ctx->rp_size;
+	return -1;
+}
 
-			free(tmplist);
-			tmplist = node;
-		}
-		free(tmplist);
+/* Returns the time in seconds until the next event (rp_pkt) is due */
+static double replay_due(struct spnav_ctx *ctx)
+{
+	double t;
+	struct spnav_timestamp now;
 
-		return rm_count;
+	if(ctx->rp_speed <= 0.0) {
+		return 0.0;
 	}
-	return 0;
+	get_time(&now);
+
+	t = (ctx->rp_time.sec - ctx->rp_base.sec) + (ctx->rp_time.nsec - ctx->rp_base.nsec) / 1e9;
+	return t / ctx->rp_speed - (now.sec - ctx->rp_start.sec) -
+		(now.nsec - ctx->rp_start.nsec) / 1e9;
 }
 
-#ifdef SPNAV_USE_X11
-int spnav_x11_event(const XEvent *xev, spnav_event *event)
+#ifdef SPNAV_USE_THREADS
+/* Returns the number of milliseconds until the next event of the log being
+ * replayed is due, rounded up, or 0 if it's due already, or there are no more.
+ */
+static int replay_timeout(struct spnav_ctx *ctx)
 {
-	int i;
-	int xmsg_type;
+	double t;
 
-	if(xev->type != ClientMessage) {
+	if(!ctx->rp_have && replay_decode(ctx) == -1) {
 		return 0;
 	}
+	if((t = replay_due(ctx)) <= 0.0) {
+		return 0;
+	}
+	return t > 3600.0 ? 3600000 : (int)(t * 1000.0) + 1;
+}
+#endif
 
-	xmsg_type = xev->xclient.message_type;
+/* Copies the next events of the log being replayed to the receive buffer once
+ * they are due, as if they had just been read from the daemon socket. Events
+ * which were received together are replayed together, with their recorded
+ * receive time. If block is non-zero, waits until they are due, otherwise
+ * returns 0 if they aren't yet. Returns the number of bytes copied, or -1 at
+ * the end of the log.
+ */
+static int replay_fill(struct spnav_ctx *ctx, int block)
+{
+	int count = 0;
+	double t;
+	struct timespec ts;
+	struct spnav_timestamp time;
 
-	if(xmsg_type != motion_event && xmsg_type != button_press_event &&
-			xmsg_type != button_release_event) {
-		return 0;
+	if(!ctx->rp_have && replay_decode(ctx) == -1) {
+		return -1;
 	}
 
-	if(xmsg_type == motion_event) {
-		event->type = SPNAV_EVENT_MOTION;
-		event->motion.data = &event->motion.x;
+	while((t = replay_due(ctx)) > 0.0) {
+		if(!block) return 0;
 
-		for(i=0; i<6; i++) {
-			event->motion.data[i] = xev->xclient.data.s[i + 2];
-		}
-		event->motion.period = xev->xclient.data.s[8];
-	} else {
-		event->type = SPNAV_EVENT_BUTTON;
-		event->button.press = xmsg_type == button_press_event ? 1 : 0;
-		event->button.bnum = xev->xclient.data.s[2];
+		ts.tv_sec = (time_t)t;
+		ts.tv_nsec = (long)((t - ts.tv_sec) * 1e9);
+		nanosleep(&ts, 0);
 	}
-	return event->type;
-}
 
+	time = ctx->rp_time;
+	do {
+		memcpy((char*)ctx->rxbuf + ctx->rx_end, ctx->rp_pkt, sizeof ctx->rp_pkt);
+		ctx->rx_end += sizeof ctx->rp_pkt;
+		count += sizeof ctx->rp_pkt;
+		ctx->rp_have = 0;
+	} while(ctx->rx_end + sizeof ctx->rp_pkt <= sizeof ctx->rxbuf && replay_decode(ctx) == 0 &&
+			ctx->rp_time.sec == time.sec && ctx->rp_time.nsec == time.nsec);
+
+	ctx->rx_time = time;
+	return count;
+}
 
-static Window get_daemon_window(Display *dpy)
+/* Opens an event log for replay. The mapped file descriptor stands in for the
+ * daemon socket: it keeps the context open, and spnav_fd returns it. Requests
+ * fail, because the protocol version is 0, and writes to it fail anyway.
+ */
+static int replay_open(struct spnav_ctx *ctx, const char *path, double speed)
 {
-	Window win, root_win;
-	XTextProperty wname;
-	Atom type;
-	int fmt;
-	unsigned long nitems, bytes_after;
-	unsigned char *prop;
+	int fd, sec, nsec;
+	void *data;
+	struct stat st;
+	struct blob b = {0};
 
-	root_win = DefaultRootWindow(dpy);
+	if(IS_OPEN(ctx) || ctx->open_state != OPEN_IDLE || speed < 0.0) {
+		return -1;
+	}
 
-	XGetWindowProperty(dpy, root_win, command_event, 0, 1, False, AnyPropertyType, &type, &fmt, &nitems, &bytes_after, &prop);
-	if(!prop) {
-		return 0;
+	if((fd = open(path, O_RDONLY)) == -1) {
+		return -1;
+	}
+	if(fstat(fd, &st) == -1 || st.st_size < REC_SIG_LEN ||
+			(data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		close(fd);
+		return -1;
 	}
+	b.rdptr = (unsigned char*)data + REC_SIG_LEN;
+	b.end = (unsigned char*)data + st.st_size;
 
-	win = *(Window*)prop;
-	XFree(prop);
+	if(memcmp(data, REC_SIG, REC_SIG_LEN) != 0 || blob_get_int(&b, &sec) == -1 ||
+			blob_get_int(&b, &nsec) == -1 || open_init(ctx) == -1) {
+		munmap(data, st.st_size);
+		close(fd);
+		return -1;
+	}
 
-	if(!XGetWMName(dpy, win, &wname) || strcmp("Magellan Window", (char*)wname.value) != 0) {
+	ctx->rp_data = data;
+	ctx->rp_size = st.st_size;
+	ctx->rp_pos = b.rdptr - ctx->rp_data;
+	ctx->rp_speed = speed;
+	ctx->rp_have = 0;
+	memset(ctx->rp_motion, 0, sizeof ctx->rp_motion);
+	ctx->rp_base.sec = sec;
+	ctx->rp_base.nsec = nsec;
+	ctx->rp_time = ctx->rp_base;
+	get_time(&ctx->rp_start);
+
+	/* the log only holds events which were delivered to the application,
+	 * and there's no daemon to keep the config cache coherent
+	 */
+	ctx->evmask = SPNAV_EVMASK_ALL;
+	ctx->cfgc_state = -1;
+	ctx->sock = fd;
+	return 0;
+}
+
+spnav_ctx *spnav_ctx_open_replay(const char *path, double speed)
+{
+	struct spnav_ctx *ctx;
+
+	if(!(ctx = malloc(sizeof *ctx))) {
 		return 0;
 	}
+	init_ctx(ctx);
 
-	return win;
+	if(replay_open(ctx, path, speed) == -1) {
+		destroy_ctx(ctx);
+		return 0;
+	}
+	return ctx;
 }
 
-int catch_badwin(Display *dpy, XErrorEvent *err)
+
+/* Default context API
+ * ---------------------------------------------------------------------------
+ * The original, single-connection API is implemented in terms of the context
+ * API, operating on the default context.
+ */
+
+int spnav_open(void)
 {
-	char buf[256];
+	return open_ctx(get_defctx());
+}
 
-	if(err->error_code == BadWindow) {
-		/* do nothing? */
-	} else {
-		XGetErrorText(dpy, err->error_code, buf, sizeof buf);
-		fprintf(stderr, "libspnav: caught unexpected X error: %s\n", buf);
-	}
-	return 0;
+int spnav_open_async(void)
+{
+	return open_start(get_defctx());
+}
+
+int spnav_open_continue(int *timeout_ms)
+{
+	return open_continue(get_defctx(), timeout_ms);
+}
+
+#ifdef SPNAV_USE_X11
+int spnav_x11_open(Display *dpy, Window win)
+{
+	return x11_open_ctx(get_defctx(), dpy, win);
+}
+
+int spnav_x11_window(Window win)
+{
+	return spnav_ctx_x11_window(get_defctx(), win);
+}
+
+int spnav_x11_event(const XEvent *xev, spnav_event *event)
+{
+	return spnav_ctx_x11_event(get_defctx(), xev, event);
 }
 #endif
 
-static void flush_resp(void)
+int spnav_close(void)
 {
-	int res;
-	char buf[256];
-	fd_set rdset;
-	struct timeval tv = {0};
+	return close_ctx(get_defctx());
+}
 
-	FD_ZERO(&rdset);
-	FD_SET(sock, &rdset);
+int spnav_sensitivity(double sens)
+{
+	return spnav_ctx_sensitivity(get_defctx(), sens);
+}
 
-	while((res = select(sock + 1, &rdset, 0, 0, &tv)) > 0 || (res == -1 && errno == EINTR)) {
-		read(sock, buf, sizeof buf);
-	}
+int spnav_fd(void)
+{
+	return spnav_ctx_fd(get_defctx());
 }
 
-static int wait_resp(void *buf, int sz, int timeout_ms)
+int spnav_wait_event(spnav_event *event)
 {
-	int res;
-	fd_set rdset;
-	struct timeval tv;
-	char *ptr;
-
-	if(timeout_ms) {
-		FD_ZERO(&rdset);
-		FD_SET(sock, &rdset);
+	return spnav_ctx_wait_event(get_defctx(), event);
+}
 
-		if(timeout_ms > 0) {
-			tv.tv_sec = timeout_ms / 1000;
-			tv.tv_usec = (timeout_ms % 1000) * 1000;
-		}
+int spnav_poll_event(spnav_event *event)
+{
+	return spnav_ctx_poll_event(get_defctx(), event);
+}
 
-		while((res = select(sock + 1, &rdset, 0, 0, timeout_ms < 0 ? 0 : &tv)) == -1 && errno == EINTR);
-	}
+int spnav_wait_events(spnav_event *evbuf, int max)
+{
+	return spnav_ctx_wait_events(get_defctx(), evbuf, max);
+}
 
-	if(!timeout_ms || (res > 0 && FD_ISSET(sock, &rdset))) {
-		ptr = buf;
-		while(sz > 0) {
-			if((res = read(sock, ptr, sz)) <= 0 && errno != EINTR) {
-				return -1;
-			}
-			ptr += res;
-			sz -= res;
-		}
-		return 0;
-	}
-	return -1;
+int spnav_poll_events(spnav_event *evbuf, int max)
+{
+	return spnav_ctx_poll_events(get_defctx(), evbuf, max);
 }
 
-static int request(int req, struct reqresp *rr, int timeout_ms)
+int spnav_wait_events_ts(spnav_event *evbuf, struct spnav_timestamp *tsbuf, int max)
 {
-	if(sock < 0 || proto < 1) return -1;
+	return spnav_ctx_wait_events_ts(get_defctx(), evbuf, tsbuf, max);
+}
 
-	flush_resp();
+int spnav_poll_events_ts(spnav_event *evbuf, struct spnav_timestamp *tsbuf, int max)
+{
+	return spnav_ctx_poll_events_ts(get_defctx(), evbuf, tsbuf, max);
+}
 
-	req |= REQ_TAG;
-	rr->type = req;
+int spnav_event_time(struct spnav_timestamp *ts)
+{
+	return spnav_ctx_event_time(get_defctx(), ts);
+}
 
-	write(sock, rr, sizeof *rr);
-	if(wait_resp(rr, sizeof *rr, TIMEOUT) == -1) {
-		return -1;
-	}
+int spnav_remove_events(int type)
+{
+	return spnav_ctx_remove_events(get_defctx(), type);
+}
 
-	/* XXX assuming data[6] is always status */
-	if(rr->type != req || rr->data[6] < 0) return -1;
-	return 0;
+int spnav_queue_size(int size)
+{
+	return spnav_ctx_queue_size(get_defctx(), size);
 }
 
-static int request_str(int req, char *buf, int bufsz, int timeout_ms)
+unsigned long spnav_queue_dropped(void)
 {
-	int res = -1;
-	struct reqresp rr = {0};
-	struct reqresp_strbuf sbuf = {0};
+	return spnav_ctx_queue_dropped(get_defctx());
+}
 
-	if(request(req, &rr, timeout_ms) == -1) {
-		return -1;
-	}
+int spnav_get_state(struct spnav_state *st)
+{
+	return spnav_ctx_get_state(get_defctx(), st);
+}
 
-	while((res = spnav_recv_str(&sbuf, &rr)) == 0) {
-		if(wait_resp(&rr, sizeof rr, timeout_ms) == -1) {
-			free(sbuf.buf);
-			return -1;
-		}
-	}
+int spnav_coalesce(int mode)
+{
+	return spnav_ctx_coalesce(get_defctx(), mode);
+}
 
-	if(res == -1) {
-		free(sbuf.buf);
-		return -1;
-	}
+int spnav_reader_thread(int enable)
+{
+	return spnav_ctx_reader_thread(get_defctx(), enable);
+}
 
-	if(buf) {
-		strncpy(buf, sbuf.buf, bufsz - 1);
-		buf[bufsz - 1] = 0;
-	}
-	free(sbuf.buf);
-	return sbuf.size - 1;
+int spnav_record_start(const char *path)
+{
+	return spnav_ctx_record_start(get_defctx(), path);
 }
 
+int spnav_record_stop(void)
+{
+	return spnav_ctx_record_stop(get_defctx());
+}
 
+int spnav_open_replay(const char *path, double speed)
+{
+	return replay_open(get_defctx(), path, speed);
+}
 
 int spnav_protocol(void)
 {
-	return proto;
+	return spnav_ctx_protocol(get_defctx());
 }
 
 int spnav_client_name(const char *name)
 {
-	return spnav_send_str(sock, REQ_SET_NAME, name);
+	return spnav_ctx_client_name(get_defctx(), name);
 }
 
 int spnav_evmask(unsigned int mask)
 {
-	struct reqresp rr = {0};
-	rr.data[0] = mask;
-	if(request(REQ_SET_EVMASK, &rr, TIMEOUT) == -1) {
-		return -1;
-	}
-	return 0;
+	return spnav_ctx_evmask(get_defctx(), mask);
+}
+
+int spnav_num_devices(void)
+{
+	return spnav_ctx_num_devices(get_defctx());
+}
+
+int spnav_select_device(int dev)
+{
+	return spnav_ctx_select_device(get_defctx(), dev);
+}
+
+int spnav_dev_id(void)
+{
+	return spnav_ctx_dev_id(get_defctx());
 }
 
 int spnav_dev_name(char *buf, int bufsz)
 {
-	return request_str(REQ_DEV_NAME, buf, bufsz, TIMEOUT);
+	return spnav_ctx_dev_name(get_defctx(), buf, bufsz);
 }
 
 int spnav_dev_path(char *buf, int bufsz)
 {
-	return request_str(REQ_DEV_PATH, buf, bufsz, TIMEOUT);
+	return spnav_ctx_dev_path(get_defctx(), buf, bufsz);
 }
 
 int spnav_dev_buttons(void)
 {
-	struct reqresp rr = {0};
-	if(request(REQ_DEV_NBUTTONS, &rr, TIMEOUT) == -1) {
-		return 2;	/* default */
-	}
-	return rr.data[0];
+	return spnav_ctx_dev_buttons(get_defctx());
 }
 
 int spnav_dev_axes(void)
 {
-	struct reqresp rr = {0};
-	if(request(REQ_DEV_NAXES, &rr, TIMEOUT) == -1) {
-		return 6;	/* default */
-	}
-	return rr.data[0];
+	return spnav_ctx_dev_axes(get_defctx());
 }
 
 int spnav_dev_usbid(unsigned int *vend, unsigned int *prod)
 {
-	struct reqresp rr = {0};
-	if(request(REQ_DEV_USBID, &rr, TIMEOUT) == -1) {
-		return -1;
-	}
-	if(vend) *vend = rr.data[0];
-	if(prod) *prod = rr.data[1];
-	return 0;
+	return spnav_ctx_dev_usbid(get_defctx(), vend, prod);
 }
 
 int spnav_dev_type(void)
 {
-	struct reqresp rr = {0};
-	if(request(REQ_DEV_TYPE, &rr, TIMEOUT) == -1) {
-		return -1;
-	}
-	return rr.data[0];
+	return spnav_ctx_dev_type(get_defctx());
+}
+
+int spnav_cfg_begin(void)
+{
+	return spnav_ctx_cfg_begin(get_defctx());
+}
+
+int spnav_cfg_commit(int *status, int max)
+{
+	return spnav_ctx_cfg_commit(get_defctx(), status, max);
 }
 
+int spnav_profile_capture(struct spnav_profile *prof)
+{
+	return spnav_ctx_profile_capture(get_defctx(), prof);
+}
 
-/* configuation api */
+int spnav_profile_apply(const struct spnav_profile *prof)
+{
+	return spnav_ctx_profile_apply(get_defctx(), prof);
+}
 
 int spnav_cfg_reset(void)
 {
-	struct reqresp rr = {0};
-	return request(REQ_CFG_RESET, &rr, TIMEOUT);
+	return spnav_ctx_cfg_reset(get_defctx());
 }
 
 int spnav_cfg_restore(void)
 {
-	struct reqresp rr = {0};
-	return request(REQ_CFG_RESTORE, &rr, TIMEOUT);
+	return spnav_ctx_cfg_restore(get_defctx());
 }
 
 int spnav_cfg_save(void)
 {
-	struct reqresp rr = {0};
-	return request(REQ_CFG_SAVE, &rr, TIMEOUT);
+	return spnav_ctx_cfg_save(get_defctx());
 }
 
 int spnav_cfg_set_sens(float s)
 {
-	struct reqresp rr = {0};
-	rr.data[0] = *(int*)&s;
-	return request(REQ_SCFG_SENS, &rr, TIMEOUT);
+	return spnav_ctx_cfg_set_sens(get_defctx(), s);
 }
 
 float spnav_cfg_get_sens(void)
 {
-	struct reqresp rr = {0};
-	if(request(REQ_GCFG_SENS, &rr, TIMEOUT) == -1) {
-		return -1.0f;
-	}
-	return *(float*)&rr.data[0];
+	return spnav_ctx_cfg_get_sens(get_defctx());
 }
 
 int spnav_cfg_set_axis_sens(const float *svec)
 {
-	struct reqresp rr;
-	memcpy(rr.data, svec, 6 * sizeof *svec);
-	return request(REQ_SCFG_SENS_AXIS, &rr, TIMEOUT);
+	return spnav_ctx_cfg_set_axis_sens(get_defctx(), svec);
 }
 
 int spnav_cfg_get_axis_sens(float *svec)
 {
-	struct reqresp rr = {0};
-
-	if(request(REQ_GCFG_SENS_AXIS, &rr, TIMEOUT) == -1) {
-		return -1;
-	}
-	memcpy(svec, rr.data, 6 * sizeof *svec);
-	return 0;
+	return spnav_ctx_cfg_get_axis_sens(get_defctx(), svec);
 }
 
 int spnav_cfg_set_deadzone(int axis, int delta)
 {
-	struct reqresp rr = {0};
-
-	rr.data[0] = axis;
-	rr.data[1] = delta;
-	return request(REQ_SCFG_DEADZONE, &rr, TIMEOUT);
+	return spnav_ctx_cfg_set_deadzone(get_defctx(), axis, delta);
 }
 
 int spnav_cfg_get_deadzone(int axis)
 {
-	struct reqresp rr = {0};
-
-	rr.data[0] = axis;
-	if(request(REQ_GCFG_DEADZONE, &rr, TIMEOUT) == -1) {
-		return -1;
-	}
-	return rr.data[1];
+	return spnav_ctx_cfg_get_deadzone(get_defctx(), axis);
 }
 
 int spnav_cfg_set_invert(int invbits)
 {
-	int i;
-	struct reqresp rr;
-
-	for(i=0; i<6; i++) {
-		rr.data[i] = invbits & 1;
-		invbits >>= 1;
-	}
-	return request(REQ_SCFG_INVERT, &rr, TIMEOUT);
+	return spnav_ctx_cfg_set_invert(get_defctx(), invbits);
 }
 
 int spnav_cfg_get_invert(void)
 {
-	int i, res = 0;
-	struct reqresp rr = {0};
-
-	if(request(REQ_GCFG_INVERT, &rr, TIMEOUT) == -1) {
-		return -1;
-	}
-	for(i=0; i<6; i++) {
-		res = (res >> 1) | (rr.data[i] ? 0x20 : 0);
-	}
-	return res;
+	return spnav_ctx_cfg_get_invert(get_defctx());
 }
 
 int spnav_cfg_set_axismap(int devaxis, int map)
 {
-	struct reqresp rr = {0};
-
-	rr.data[0] = devaxis;
-	rr.data[1] = map;
-	return request(REQ_SCFG_AXISMAP, &rr, TIMEOUT);
+	return spnav_ctx_cfg_set_axismap(get_defctx(), devaxis, map);
 }
 
 int spnav_cfg_get_axismap(int devaxis)
 {
-	struct reqresp rr = {0};
-
-	rr.data[0] = devaxis;
-	if(request(REQ_GCFG_AXISMAP, &rr, TIMEOUT) == -1) {
-		return -1;
-	}
-	return rr.data[1];
+	return spnav_ctx_cfg_get_axismap(get_defctx(), devaxis);
 }
 
 int spnav_cfg_set_bnmap(int devbn, int map)
 {
-	struct reqresp rr = {0};
-
-	rr.data[0] = devbn;
-	rr.data[1] = map;
-	return request(REQ_SCFG_BNMAP, &rr, TIMEOUT);
+	return spnav_ctx_cfg_set_bnmap(get_defctx(), devbn, map);
 }
 
 int spnav_cfg_get_bnmap(int devbn)
 {
-	struct reqresp rr = {0};
-
-	rr.data[0] = devbn;
-	if(request(REQ_GCFG_BNMAP, &rr, TIMEOUT) == -1) {
-		return -1;
-	}
-	return rr.data[1];
+	return spnav_ctx_cfg_get_bnmap(get_defctx(), devbn);
 }
 
 int spnav_cfg_set_bnaction(int bn, int act)
 {
-	struct reqresp rr = {0};
-
-	rr.data[0] = bn;
-	rr.data[1] = act;
-	return request(REQ_SCFG_BNACTION, &rr, TIMEOUT);
+	return spnav_ctx_cfg_set_bnaction(get_defctx(), bn, act);
 }
 
 int spnav_cfg_get_bnaction(int bn)
 {
-	struct reqresp rr = {0};
-
-	rr.data[0] = bn;
-	if(request(REQ_GCFG_BNACTION, &rr, TIMEOUT) == -1) {
-		return -1;
-	}
-	return rr.data[1];
+	return spnav_ctx_cfg_get_bnaction(get_defctx(), bn);
 }
 
 int spnav_cfg_set_kbmap(int bn, int key)
 {
-	struct reqresp rr = {0};
-
-	rr.data[0] = bn;
-	rr.data[1] = key;
-	return request(REQ_SCFG_KBMAP, &rr, TIMEOUT);
+	return spnav_ctx_cfg_set_kbmap(get_defctx(), bn, key);
 }
 
 int spnav_cfg_get_kbmap(int bn)
 {
-	struct reqresp rr = {0};
+	return spnav_ctx_cfg_get_kbmap(get_defctx(), bn);
+}
 
-	rr.data[0] = bn;
-	if(request(REQ_GCFG_KBMAP, &rr, TIMEOUT) == -1) {
-		return -1;
-	}
-	return rr.data[1];
+int spnav_cfg_set_deadzones(int first, int count, const int *delta)
+{
+	return spnav_ctx_cfg_set_deadzones(get_defctx(), first, count, delta);
 }
 
-int spnav_cfg_set_swapyz(int swap)
+int spnav_cfg_get_deadzones(int first, int count, int *delta)
 {
-	struct reqresp rr = {0};
+	return spnav_ctx_cfg_get_deadzones(get_defctx(), first, count, delta);
+}
 
-	rr.data[0] = swap;
-	return request(REQ_SCFG_SWAPYZ, &rr, TIMEOUT);
+int spnav_cfg_set_axismaps(int first, int count, const int *map)
+{
+	return spnav_ctx_cfg_set_axismaps(get_defctx(), first, count, map);
 }
 
-int spnav_cfg_get_swapyz(void)
+int spnav_cfg_get_axismaps(int first, int count, int *map)
 {
-	struct reqresp rr = {0};
+	return spnav_ctx_cfg_get_axismaps(get_defctx(), first, count, map);
+}
 
-	if(request(REQ_GCFG_SWAPYZ, &rr, TIMEOUT) == -1) {
-		return -1;
-	}
-	return rr.data[0];
+int spnav_cfg_set_bnmaps(int first, int count, const int *map)
+{
+	return spnav_ctx_cfg_set_bnmaps(get_defctx(), first, count, map);
 }
 
-int spnav_cfg_set_led(int state)
+int spnav_cfg_get_bnmaps(int first, int count, int *map)
 {
-	struct reqresp rr = {0};
+	return spnav_ctx_cfg_get_bnmaps(get_defctx(), first, count, map);
+}
 
-	if(state < 0 || state >= 3) return -1;
+int spnav_cfg_set_bnactions(int first, int count, const int *act)
+{
+	return spnav_ctx_cfg_set_bnactions(get_defctx(), first, count, act);
+}
 
-	rr.data[0] = state;
-	return request(REQ_SCFG_LED, &rr, TIMEOUT);
+int spnav_cfg_get_bnactions(int first, int count, int *act)
+{
+	return spnav_ctx_cfg_get_bnactions(get_defctx(), first, count, act);
 }
 
-int spnav_cfg_get_led(void)
+int spnav_cfg_set_kbmaps(int first, int count, const int *key)
 {
-	struct reqresp rr = {0};
+	return spnav_ctx_cfg_set_kbmaps(get_defctx(), first, count, key);
+}
 
-	if(request(REQ_GCFG_LED, &rr, TIMEOUT) == -1) {
-		return -1;
-	}
-	return rr.data[0];
+int spnav_cfg_get_kbmaps(int first, int count, int *key)
+{
+	return spnav_ctx_cfg_get_kbmaps(get_defctx(), first, count, key);
 }
 
-int spnav_cfg_set_grab(int state)
+int spnav_cfg_set_swapyz(int swap)
 {
-	struct reqresp rr = {0};
+	return spnav_ctx_cfg_set_swapyz(get_defctx(), swap);
+}
 
-	rr.data[0] = state ? 1 : 0;
-	return request(REQ_SCFG_GRAB, &rr, TIMEOUT);
+int spnav_cfg_get_swapyz(void)
+{
+	return spnav_ctx_cfg_get_swapyz(get_defctx());
 }
 
-int spnav_cfg_get_grab(void)
+int spnav_cfg_set_led(int state)
 {
-	struct reqresp rr = {0};
+	return spnav_ctx_cfg_set_led(get_defctx(), state);
+}
 
-	if(request(REQ_GCFG_GRAB, &rr, TIMEOUT) == -1) {
-		return -1;
-	}
-	return rr.data[0];
+int spnav_cfg_get_led(void)
+{
+	return spnav_ctx_cfg_get_led(get_defctx());
+}
+
+int spnav_cfg_set_grab(int state)
+{
+	return spnav_ctx_cfg_set_grab(get_defctx(), state);
+}
+
+int spnav_cfg_get_grab(void)
+{
+	return spnav_ctx_cfg_get_grab(get_defctx());
 }
 
 int spnav_cfg_set_serial(const char *devpath)
 {
-	return spnav_send_str(sock, REQ_SCFG_SERDEV, devpath);
+	return spnav_ctx_cfg_set_serial(get_defctx(), devpath);
 }
 
 int spnav_cfg_get_serial(char *buf, int bufsz)
 {
-	return request_str(REQ_GCFG_SERDEV, buf, bufsz, TIMEOUT);
+	return spnav_ctx_cfg_get_serial(get_defctx(), buf, bufsz);
 }
 
 int spnav_cfg_set_repeat(int msec)
 {
-	struct reqresp rr = {0};
+	return spnav_ctx_cfg_set_repeat(get_defctx(), msec);
+}
 
-	if(msec < 0) msec = -1;
+int spnav_cfg_get_repeat(void)
+{
+	return spnav_ctx_cfg_get_repeat(get_defctx());
+}
 
-	rr.data[0] = msec;
-	return request(REQ_SCFG_REPEAT, &rr, TIMEOUT);
+int spnav_request_async(int req, const int *data, int timeout_ms, spnav_request_callback cb, void *cls)
+{
+	return spnav_ctx_request_async(get_defctx(), req, data, timeout_ms, cb, cls);
 }
 
-int spnav_cfg_get_repeat(void)
+int spnav_request_cancel(int token)
 {
-	struct reqresp rr = {0};
+	return spnav_ctx_request_cancel(get_defctx(), token);
+}
 
-	if(request(REQ_GCFG_REPEAT, &rr, TIMEOUT) == -1) {
-		return -1;
-	}
-	return rr.data[0];
+int spnav_request_timeout(void)
+{
+	return spnav_ctx_request_timeout(get_defctx());
 }
@@ -42,7 +42,9 @@ enum {
 	SPNAV_EVENT_CFG,	/* configuration change event */
 
 	SPNAV_EVENT_RAWAXIS,
-	SPNAV_EVENT_RAWBUTTON
+	SPNAV_EVENT_RAWBUTTON,
+
+	SPNAV_EVENT_REQ		/* asynchronous request completion */
 };
 
 enum { SPNAV_DEV_ADD, SPNAV_DEV_RM };
@@ -81,6 +83,13 @@ struct spnav_event_axis {
 	int value;			/* value */
 };
 
+struct spnav_event_req {
+	int type;			/* SPNAV_EVENT_REQ */
+	int token;			/* as returned by spnav_request_async */
+	int status;			/* 0 on success, SPNAV_REQ_FAILED or SPNAV_REQ_TIMEOUT */
+	int data[6];		/* same as protocol response data 0-5 */
+};
+
 typedef union spnav_event {
 	int type;
 	struct spnav_event_motion motion;
@@ -88,8 +97,12 @@ typedef union spnav_event {
 	struct spnav_event_dev dev;
 	struct spnav_event_cfg cfg;
 	struct spnav_event_axis axis;
+	struct spnav_event_req req;
 } spnav_event;
 
+/* opaque connection context (see "Connection contexts" below) */
+typedef struct spnav_ctx spnav_ctx;
+
 
 #ifdef __cplusplus
 extern "C" {
@@ -99,21 +112,54 @@ extern "C" {
  * The unix domain socket interface is an alternative to the original magellan
  * protocol, and it is *NOT* compatible with the 3D connexion driver. If you wish
  * to remain compatible, use the X11 protocol (spnav_x11_open, see below).
+ * The protocol version negotiated with each daemon instance is cached in
+ * $XDG_RUNTIME_DIR/libspnav-proto, to avoid waiting for the negotiation to time
+ * out every time with old versions of spacenavd.
  * Returns -1 on failure.
  */
 int spnav_open(void);
 
+/* Asynchronous version of spnav_open, for programs which can't afford to block
+ * while connecting to the daemon and negotiating the protocol version (up to
+ * 300ms with old versions of spacenavd). spnav_open_async starts opening the
+ * connection, and returns 0, or -1 on immediate failure. Then the application
+ * should call spnav_open_continue, which advances the process as far as it can
+ * without blocking, and returns:
+ *  - 0 when the connection is open, and ready for use.
+ *  - -1 if opening the connection failed.
+ *  - SPNAV_OPEN_WAIT_READ or SPNAV_OPEN_WAIT_WRITE while it's in progress. In
+ *    that case, the application should call spnav_open_continue again when the
+ *    file descriptor returned by spnav_fd becomes readable or writable
+ *    respectively, or after timeout_ms milliseconds, whichever comes first.
+ *    timeout_ms may be null.
+ *  - SPNAV_OPEN_WAIT_TIMEOUT if the daemon is too busy to accept the connection
+ *    right now. The application should call spnav_open_continue again after
+ *    timeout_ms milliseconds, without waiting on the file descriptor.
+ * While opening, no other function should be used, except for spnav_fd, and
+ * spnav_close to abort.
+ */
+enum {
+	SPNAV_OPEN_WAIT_READ = 1,
+	SPNAV_OPEN_WAIT_WRITE,
+	SPNAV_OPEN_WAIT_TIMEOUT
+};
+int spnav_open_async(void);
+int spnav_open_continue(int *timeout_ms);
+
 /* Close connection to the daemon. Use it for X11 or AF_UNIX connections.
  * Returns -1 on failure
  */
 int spnav_close(void);
 
 /* Retrieves the file descriptor used for communication with the daemon, for
- * use with select() by the application, if so required.
+ * use with select() or poll() by the application, if so required.
  * If the X11 mode is used, the socket used to communicate with the X server is
  * returned, so the result of this function is always reliable.
  * If AF_UNIX mode is used, the fd of the socket is returned or -1 if
  * no connection is open / failure occurred.
+ * Events arriving while waiting for the response to a request are queued, so
+ * drain them with spnav_poll_event after making requests, before waiting on the
+ * file descriptor again.
  */
 int spnav_fd(void);
 
@@ -128,12 +174,135 @@ int spnav_wait_event(spnav_event *event);
  */
 int spnav_poll_event(spnav_event *event);
 
+/* Batched versions of spnav_wait_event and spnav_poll_event. They drain as many
+ * pending events as are available, up to max, into the evbuf array, reading
+ * multiple packets from the daemon with a single system call.
+ * spnav_wait_events blocks until at least one event is available, while
+ * spnav_poll_events returns immediately.
+ * Both return the number of events written to evbuf (0 on error, or if no
+ * events are pending in the case of spnav_poll_events).
+ */
+int spnav_wait_events(spnav_event *evbuf, int max);
+int spnav_poll_events(spnav_event *evbuf, int max);
+
+/* Event receive timestamps, from the monotonic system clock (CLOCK_MONOTONIC
+ * on POSIX systems), for measuring how old an event is by the time it's used.
+ * Events are timestamped when libspnav reads them from the daemon socket (or
+ * from the X event queue when using the X11 protocol).
+ */
+struct spnav_timestamp {
+	long sec;
+	long nsec;
+};
+
+/* Same as spnav_wait_events/spnav_poll_events, but also write the receive time
+ * of each event into the corresponding element of the tsbuf array.
+ */
+int spnav_wait_events_ts(spnav_event *evbuf, struct spnav_timestamp *tsbuf, int max);
+int spnav_poll_events_ts(spnav_event *evbuf, struct spnav_timestamp *tsbuf, int max);
+
+/* Writes the receive time of the last event returned by spnav_wait_event or
+ * spnav_poll_event through ts. Only works with the native protocol.
+ * Returns 0 on success, -1 if no event has been received yet.
+ */
+int spnav_event_time(struct spnav_timestamp *ts);
+
 /* Removes any pending events from the specified type, or all pending events
  * events if the type argument is SPNAV_EVENT_ANY. Returns the number of
  * removed events.
  */
 int spnav_remove_events(int type);
 
+/* Sets the capacity of the client-side event queue, which holds events read
+ * from the daemon but not yet delivered (default: 256 events). The queue is
+ * allocated once by spnav_open; calling this while connected reallocates it.
+ * When the queue is full, the oldest pending motion event is dropped to make
+ * room for the new one (or the oldest event, if none of them are motion
+ * events). Returns 0 on success, -1 on failure.
+ */
+int spnav_queue_size(int size);
+
+/* Returns the number of events dropped due to event queue overflow, since the
+ * connection was opened.
+ */
+unsigned long spnav_queue_dropped(void);
+
+/* Motion event coalescing modes (see spnav_coalesce) */
+enum {
+	SPNAV_COALESCE_NONE,		/* deliver every motion event (default) */
+	SPNAV_COALESCE_LATEST,		/* keep the values of the latest event */
+	SPNAV_COALESCE_WEIGHTED		/* period-weighted average of all events */
+};
+
+/* Enables merging of consecutive motion events, with no other events between
+ * them, into a single motion event. Every time the application asks for events,
+ * all events pending on the daemon socket are drained, and each run of motion
+ * events is delivered as one motion event, with a period equal to the sum of
+ * their periods. With SPNAV_COALESCE_WEIGHTED, the motion values are the
+ * period-weighted average of the merged events, so applications should scale
+ * motion by the period to get the same total motion as processing each event.
+ * Events with a zero period carry no weight, and if none of the merged events
+ * has a period, the values of the latest one are kept.
+ * Only applies to the native protocol (spnav_open). Returns 0 on success, -1 if
+ * the mode is invalid.
+ */
+int spnav_coalesce(int mode);
+
+/* Starts (enable != 0) or stops (enable == 0) a background thread, which reads
+ * and decodes events from the daemon socket, and hands them over to the event
+ * functions through a lock-free queue. While the thread is running, polling
+ * for events doesn't make any system calls as long as there are events
+ * pending, and spnav_fd returns a file descriptor which becomes readable when
+ * the reader thread has events for the application. Events are dropped (and
+ * counted by spnav_queue_dropped) if more than 1024 pile up unread.
+ * Only available with the native protocol, and if libspnav was built with
+ * thread support. Returns 0 on success, -1 on failure.
+ */
+int spnav_reader_thread(int enable);
+
+/* Current device state: the latest motion values, and a bitmask of the buttons
+ * currently held down (bit N for button N, only buttons 0-31 are tracked).
+ * time is the receive time of the last event which changed the state.
+ */
+struct spnav_state {
+	int x, y, z;
+	int rx, ry, rz;
+	unsigned long buttons;
+	struct spnav_timestamp time;
+};
+
+/* Writes a consistent snapshot of the current device state through st.
+ * The state is updated as events are decoded, regardless of whether the
+ * application consumes them, and can be read from any thread without locking
+ * or system calls. Without the reader thread (spnav_reader_thread), events are
+ * only decoded while the application calls the event functions.
+ * Returns 0 on success, -1 if no connection is open.
+ */
+int spnav_get_state(struct spnav_state *st);
+
+/* Event recording and replay
+ * spnav_record_start writes every event decoded from the daemon connection from
+ * then on, along with its receive time, to a compact binary log at path. The
+ * log is buffered, and completed by spnav_record_stop, or spnav_close. Only
+ * available with the native protocol. Returns 0 on success, -1 on failure.
+ * spnav_record_stop returns -1 if writing the log failed at any point.
+ */
+int spnav_record_start(const char *path);
+int spnav_record_stop(void);
+
+/* Opens an event log written by spnav_record_start instead of a connection to
+ * the daemon, and replays it through the event functions. speed scales the
+ * original timing (1.0 replays in real time, 2.0 twice as fast), and 0 replays
+ * events as fast as they are read. Events carry their original timestamps, and
+ * the end of the log looks like the daemon closing the connection. There's
+ * nothing to send requests to, so all requests fail, and spnav_protocol
+ * returns 0. spnav_fd returns a file descriptor which is always readable, so
+ * applications which wait for events with poll or select should either use
+ * the reader thread (see spnav_reader_thread), or a timeout.
+ * Returns 0 on success, -1 on failure.
+ */
+int spnav_open_replay(const char *path, double speed);
+
 
 
 
@@ -193,10 +362,32 @@ enum {
 };
 int spnav_evmask(unsigned int mask);
 
-/* TODO multi-device support and device selection not implemented yet
+/* Multi-device support.
+ * libspnav keeps track of the devices known to the daemon, from device events
+ * (SPNAV_EVMASK_DEV must be enabled), plus the device the daemon reports when
+ * the device list is first needed. spnav_num_devices returns the number of
+ * known devices, or -1 if not supported. spnav_select_device selects which
+ * device (0 to spnav_num_devices() - 1) the device queries below refer to.
+ * Devices are numbered in the order they were found, and device 0 is selected
+ * by default.
+ *
+ * NOTE: the spacenav protocol doesn't identify the device that motion and
+ * button events come from, and the daemon only answers the device queries for
+ * one of the devices. For the rest, spnav_dev_type and spnav_dev_usbid return
+ * the information from their device events, while the remaining queries fail
+ * or return the defaults.
+ *
+ * The device information the daemon provides is requested all at once when the
+ * connection is opened, and cached until the next device event, so the device
+ * queries below don't normally need to wait for the daemon.
+ */
 int spnav_num_devices(void);
 int spnav_select_device(int dev);
-*/
+
+/* Returns the daemon device id of the selected device, as found in device
+ * events (struct spnav_event_dev), or -1 if unknown.
+ */
+int spnav_dev_id(void);
 
 /* Returns a descriptive device name.
  * If buf is not null, the name is copied into buf. No more than bufsz bytes are
@@ -295,6 +486,12 @@ void spnav_matrix_view(float *mat, const struct spnav_posrot *pr);
  * spnavcfg). Normal clients should avoid changing the spacenavd configuration.
  * They should use the non-persistent client-specific settings instead.
  *
+ * Configuration values retrieved by the spnav_cfg_get_* functions are cached,
+ * and the cache is kept up to date from configuration change events, which are
+ * enabled for this purpose, and only delivered if the application asked for
+ * them with spnav_evmask. Repeated queries don't go to the daemon, unless the
+ * setting has been changed by this client in the meantime.
+ *
  * All functions with return 0 on success, -1 on failure, unless noted otherwise
  */
 
@@ -359,6 +556,23 @@ int spnav_cfg_get_bnaction(int devbn);
 int spnav_cfg_set_kbmap(int devbn, int key);
 int spnav_cfg_get_kbmap(int devbn);
 
+/* Bulk versions of the per-axis and per-button functions above, which set or
+ * get count consecutive entries starting from device axis/button first, from or
+ * into an array. All requests are sent in a few bursts, instead of waiting for
+ * a round trip each, so these are much faster than calling the above in a loop.
+ * Return 0 on success, -1 on failure.
+ */
+int spnav_cfg_set_deadzones(int first, int count, const int *delta);
+int spnav_cfg_get_deadzones(int first, int count, int *delta);
+int spnav_cfg_set_axismaps(int first, int count, const int *map);
+int spnav_cfg_get_axismaps(int first, int count, int *map);
+int spnav_cfg_set_bnmaps(int first, int count, const int *map);
+int spnav_cfg_get_bnmaps(int first, int count, int *map);
+int spnav_cfg_set_bnactions(int first, int count, const int *act);
+int spnav_cfg_get_bnactions(int first, int count, int *act);
+int spnav_cfg_set_kbmaps(int first, int count, const int *key);
+int spnav_cfg_get_kbmaps(int first, int count, int *key);
+
 int spnav_cfg_set_swapyz(int swap);
 int spnav_cfg_get_swapyz(void);
 
@@ -379,6 +593,309 @@ int spnav_cfg_get_serial(char *buf, int bufsz);
 int spnav_cfg_set_repeat(int msec);
 int spnav_cfg_get_repeat(void);
 
+/* Batched configuration changes. Between spnav_cfg_begin and spnav_cfg_commit,
+ * the spnav_cfg_set_* functions, and spnav_cfg_reset/restore/save, don't wait
+ * for the daemon. Their requests are queued, and they return 0 immediately.
+ * spnav_cfg_commit sends all of them in one burst, and collects the responses.
+ * Queries and spnav_cfg_set_serial are not batched, and go to the daemon
+ * immediately, so queries return the old values until the commit.
+ *
+ * spnav_cfg_commit writes the status of each queued request (0 or -1) to the
+ * first max elements of status, in the order they were queued. status may be
+ * null if max is 0. Returns the number of failed requests (0 if everything
+ * succeeded), or -1 if the daemon stopped responding before the batch was
+ * completed; the status of any requests which didn't get a response is -1.
+ */
+int spnav_cfg_begin(void);
+int spnav_cfg_commit(int *status, int max);
+
+/* Configuration profiles
+ * A profile holds a complete set of the settings above, except for the serial
+ * device path (see below), which can be captured from the current
+ * configuration, and applied back later. Applying a profile only sends the
+ * settings which differ from the current configuration (as far as the config
+ * cache knows), in a single batch, so switching between a few profiles, for
+ * instance when the user switches between tools, is cheap.
+ *
+ * The serial device path (spnav_cfg_get_serial) is deliberately left out. It
+ * tells spacenavd where to find the device on this machine, which is not a
+ * per-application preference, and doesn't carry over to other machines.
+ *
+ * The valid field has a SPNAV_PROF_* bit for each group of settings held in
+ * the profile. Only those are applied; clear bits to apply part of a profile.
+ * Per-axis and per-button tables hold naxes and nbuttons entries respectively.
+ */
+#define SPNAV_PROF_MAX_AXES		64
+#define SPNAV_PROF_MAX_BUTTONS	64
+
+enum {
+	SPNAV_PROF_SENS			= 0x0001,
+	SPNAV_PROF_AXIS_SENS	= 0x0002,
+	SPNAV_PROF_INVERT		= 0x0004,
+	SPNAV_PROF_SWAPYZ		= 0x0008,
+	SPNAV_PROF_LED			= 0x0010,
+	SPNAV_PROF_GRAB			= 0x0020,
+	SPNAV_PROF_REPEAT		= 0x0040,
+	SPNAV_PROF_DEADZONE		= 0x0080,
+	SPNAV_PROF_AXISMAP		= 0x0100,
+	SPNAV_PROF_BNMAP		= 0x0200,
+	SPNAV_PROF_BNACTION		= 0x0400,
+	SPNAV_PROF_KBMAP		= 0x0800,
+
+	SPNAV_PROF_ALL			= 0x0fff
+};
+
+struct spnav_profile {
+	unsigned int valid;		/* SPNAV_PROF_* bits */
+	float sens, axis_sens[6];
+	int invert, swapyz, led, grab, repeat;
+	int naxes, nbuttons;
+	int deadzone[SPNAV_PROF_MAX_AXES];
+	int axismap[SPNAV_PROF_MAX_AXES];
+	int bnmap[SPNAV_PROF_MAX_BUTTONS];
+	int bnaction[SPNAV_PROF_MAX_BUTTONS];
+	int kbmap[SPNAV_PROF_MAX_BUTTONS];
+};
+
+/* Fill the profile with the current configuration. Settings which can't be
+ * retrieved are left out of prof->valid. Returns 0 on success, -1 if nothing
+ * could be retrieved.
+ */
+int spnav_profile_capture(struct spnav_profile *prof);
+
+/* Apply the valid settings of the profile, sending only the ones which differ
+ * from the current configuration, between spnav_cfg_begin and
+ * spnav_cfg_commit. Fails if a batch is already started. Returns the number of
+ * changed settings, or -1 on failure.
+ */
+int spnav_profile_apply(const struct spnav_profile *prof);
+
+/* Serialize the profile to a compact, portable binary blob. Returns the size of
+ * the blob. If buf is null, or bufsz is less than that, nothing is written, so
+ * call it with a null buf first, to find out how big a buffer is needed.
+ */
+int spnav_profile_save(const struct spnav_profile *prof, void *buf, int bufsz);
+/* Deserialize a profile blob created by spnav_profile_save. Returns 0 on
+ * success, -1 if the blob is invalid.
+ */
+int spnav_profile_load(struct spnav_profile *prof, const void *buf, int size);
+
+
+/* Asynchronous requests
+ * -----------------------------------------------------------------------------
+ * The query and configuration functions above block until the daemon responds.
+ * Programs which can't afford to block, can instead send requests with
+ * spnav_request_async, which returns immediately. The request code is one of
+ * the SPNAV_REQ_* values below, and the request data (up to 6 values, may be
+ * null) and response data are the same as in the spacenav protocol. For
+ * example the response of SPNAV_REQ_GCFG_LED has the LED state in data[0],
+ * while SPNAV_REQ_GCFG_BNMAP takes the device button number in data[0], and
+ * responds with the button number in data[0] and the mapping in data[1].
+ *
+ * When the request completes, if cb is null a SPNAV_EVENT_REQ event is returned
+ * by the spnav_poll_event/spnav_wait_event family of functions, in order with
+ * the rest of the events. Otherwise cb is called with the completion event from
+ * within those functions, instead of returning it. If the daemon doesn't
+ * respond within timeout_ms milliseconds (zero or negative means no deadline),
+ * the request completes with status SPNAV_REQ_TIMEOUT. Use spnav_request_timeout
+ * to find out how long to wait for spnav_fd, before calling spnav_poll_event to
+ * handle expired deadlines. spnav_wait_event doesn't block past them.
+ *
+ * Only works with the native protocol v1 or later. Returns a positive token
+ * identifying the request, or -1 on failure (including if too many requests
+ * are already pending).
+ */
+enum {
+	SPNAV_REQ_SET_SENS			= 0x1001,
+	SPNAV_REQ_GET_SENS,
+	SPNAV_REQ_GET_EVMASK		= 0x1004,
+
+	SPNAV_REQ_DEV_NAXES			= 0x2002,
+	SPNAV_REQ_DEV_NBUTTONS,
+	SPNAV_REQ_DEV_USBID,
+	SPNAV_REQ_DEV_TYPE,
+
+	SPNAV_REQ_SCFG_SENS			= 0x3000,
+	SPNAV_REQ_GCFG_SENS,
+	SPNAV_REQ_SCFG_SENS_AXIS,
+	SPNAV_REQ_GCFG_SENS_AXIS,
+	SPNAV_REQ_SCFG_DEADZONE,
+	SPNAV_REQ_GCFG_DEADZONE,
+	SPNAV_REQ_SCFG_INVERT,
+	SPNAV_REQ_GCFG_INVERT,
+	SPNAV_REQ_SCFG_AXISMAP,
+	SPNAV_REQ_GCFG_AXISMAP,
+	SPNAV_REQ_SCFG_BNMAP,
+	SPNAV_REQ_GCFG_BNMAP,
+	SPNAV_REQ_SCFG_BNACTION,
+	SPNAV_REQ_GCFG_BNACTION,
+	SPNAV_REQ_SCFG_KBMAP,
+	SPNAV_REQ_GCFG_KBMAP,
+	SPNAV_REQ_SCFG_SWAPYZ,
+	SPNAV_REQ_GCFG_SWAPYZ,
+	SPNAV_REQ_SCFG_LED,
+	SPNAV_REQ_GCFG_LED,
+	SPNAV_REQ_SCFG_GRAB,
+	SPNAV_REQ_GCFG_GRAB,
+	SPNAV_REQ_SCFG_REPEAT		= 0x3018,
+	SPNAV_REQ_GCFG_REPEAT,
+
+	SPNAV_REQ_CFG_SAVE			= 0x3ffe,
+	SPNAV_REQ_CFG_RESTORE,
+	SPNAV_REQ_CFG_RESET
+};
+
+/* spnav_event_req status values */
+enum { SPNAV_REQ_FAILED = -1, SPNAV_REQ_TIMEOUT = -2 };
+
+typedef void (*spnav_request_callback)(const struct spnav_event_req *ev, void *cls);
+
+int spnav_request_async(int req, const int *data, int timeout_ms, spnav_request_callback cb, void *cls);
+
+/* Cancels a pending asynchronous request. Its completion will not be delivered.
+ * Returns 0 on success, -1 if there is no such request pending.
+ */
+int spnav_request_cancel(int token);
+
+/* Returns the number of milliseconds until the earliest deadline of the pending
+ * asynchronous requests expires, or -1 if there are no deadlines pending.
+ */
+int spnav_request_timeout(void);
+
+/* Connection contexts
+ * -----------------------------------------------------------------------------
+ * Every function above operates on a single, default connection. Programs
+ * which need more than one connection, for instance independent subsystems
+ * each servicing their own connection from their own thread, can use the
+ * following context-based API instead. Each spnav_ctx_* function does the same
+ * thing as the corresponding spnav_* function, but on the connection passed
+ * through ctx. Different contexts share no state, so they can be used
+ * concurrently from different threads without locking. A single context must
+ * not be used by multiple threads at the same time (except for
+ * spnav_ctx_get_state).
+ */
+
+/* Opens a new connection to the daemon, via AF_UNIX socket (see spnav_open).
+ * Returns the new context, or a null pointer on failure.
+ */
+spnav_ctx *spnav_ctx_open(void);
+
+/* Asynchronous versions of spnav_ctx_open (see spnav_open_async). The context
+ * returned by spnav_ctx_open_async must be freed with spnav_ctx_close, even if
+ * spnav_ctx_open_continue fails.
+ */
+spnav_ctx *spnav_ctx_open_async(void);
+int spnav_ctx_open_continue(spnav_ctx *ctx, int *timeout_ms);
+
+/* Opens an event log for replay (see spnav_open_replay). Returns the new
+ * context, or a null pointer on failure.
+ */
+spnav_ctx *spnav_ctx_open_replay(const char *path, double speed);
+
+#ifdef SPNAV_USE_X11
+/* Opens a new connection using the X11 magellan protocol (see spnav_x11_open).
+ * Returns the new context, or a null pointer on failure.
+ */
+spnav_ctx *spnav_ctx_x11_open(Display *dpy, Window win);
+#endif
+
+/* Closes the connection and frees the context. Returns -1 on failure. */
+int spnav_ctx_close(spnav_ctx *ctx);
+
+/* Returns the default context used by the functions without a ctx argument,
+ * so that both APIs can be mixed for the default connection. Calling
+ * spnav_ctx_close on the default context closes the connection without
+ * freeing it.
+ */
+spnav_ctx *spnav_default_ctx(void);
+
+int spnav_ctx_fd(spnav_ctx *ctx);
+int spnav_ctx_sensitivity(spnav_ctx *ctx, double sens);
+
+int spnav_ctx_wait_event(spnav_ctx *ctx, spnav_event *event);
+int spnav_ctx_poll_event(spnav_ctx *ctx, spnav_event *event);
+int spnav_ctx_wait_events(spnav_ctx *ctx, spnav_event *evbuf, int max);
+int spnav_ctx_poll_events(spnav_ctx *ctx, spnav_event *evbuf, int max);
+int spnav_ctx_wait_events_ts(spnav_ctx *ctx, spnav_event *evbuf, struct spnav_timestamp *tsbuf, int max);
+int spnav_ctx_poll_events_ts(spnav_ctx *ctx, spnav_event *evbuf, struct spnav_timestamp *tsbuf, int max);
+int spnav_ctx_event_time(spnav_ctx *ctx, struct spnav_timestamp *ts);
+int spnav_ctx_remove_events(spnav_ctx *ctx, int type);
+int spnav_ctx_queue_size(spnav_ctx *ctx, int size);
+unsigned long spnav_ctx_queue_dropped(spnav_ctx *ctx);
+int spnav_ctx_coalesce(spnav_ctx *ctx, int mode);
+int spnav_ctx_reader_thread(spnav_ctx *ctx, int enable);
+int spnav_ctx_get_state(spnav_ctx *ctx, struct spnav_state *st);
+int spnav_ctx_record_start(spnav_ctx *ctx, const char *path);
+int spnav_ctx_record_stop(spnav_ctx *ctx);
+
+#ifdef SPNAV_USE_X11
+int spnav_ctx_x11_window(spnav_ctx *ctx, Window win);
+int spnav_ctx_x11_event(spnav_ctx *ctx, const XEvent *xev, spnav_event *event);
+#endif
+
+int spnav_ctx_protocol(spnav_ctx *ctx);
+int spnav_ctx_client_name(spnav_ctx *ctx, const char *name);
+int spnav_ctx_evmask(spnav_ctx *ctx, unsigned int mask);
+
+int spnav_ctx_num_devices(spnav_ctx *ctx);
+int spnav_ctx_select_device(spnav_ctx *ctx, int dev);
+int spnav_ctx_dev_id(spnav_ctx *ctx);
+int spnav_ctx_dev_name(spnav_ctx *ctx, char *buf, int bufsz);
+int spnav_ctx_dev_path(spnav_ctx *ctx, char *buf, int bufsz);
+int spnav_ctx_dev_buttons(spnav_ctx *ctx);
+int spnav_ctx_dev_axes(spnav_ctx *ctx);
+int spnav_ctx_dev_usbid(spnav_ctx *ctx, unsigned int *vend, unsigned int *prod);
+int spnav_ctx_dev_type(spnav_ctx *ctx);
+
+int spnav_ctx_cfg_reset(spnav_ctx *ctx);
+int spnav_ctx_cfg_restore(spnav_ctx *ctx);
+int spnav_ctx_cfg_save(spnav_ctx *ctx);
+int spnav_ctx_cfg_set_sens(spnav_ctx *ctx, float s);
+float spnav_ctx_cfg_get_sens(spnav_ctx *ctx);
+int spnav_ctx_cfg_set_axis_sens(spnav_ctx *ctx, const float *svec);
+int spnav_ctx_cfg_get_axis_sens(spnav_ctx *ctx, float *svecret);
+int spnav_ctx_cfg_set_deadzone(spnav_ctx *ctx, int devaxis, int delta);
+int spnav_ctx_cfg_get_deadzone(spnav_ctx *ctx, int devaxis);
+int spnav_ctx_cfg_set_invert(spnav_ctx *ctx, int invbits);
+int spnav_ctx_cfg_get_invert(spnav_ctx *ctx);
+int spnav_ctx_cfg_set_axismap(spnav_ctx *ctx, int devaxis, int map);
+int spnav_ctx_cfg_get_axismap(spnav_ctx *ctx, int devaxis);
+int spnav_ctx_cfg_set_bnmap(spnav_ctx *ctx, int devbn, int map);
+int spnav_ctx_cfg_get_bnmap(spnav_ctx *ctx, int devbn);
+int spnav_ctx_cfg_set_bnaction(spnav_ctx *ctx, int devbn, int act);
+int spnav_ctx_cfg_get_bnaction(spnav_ctx *ctx, int devbn);
+int spnav_ctx_cfg_set_kbmap(spnav_ctx *ctx, int devbn, int key);
+int spnav_ctx_cfg_get_kbmap(spnav_ctx *ctx, int devbn);
+int spnav_ctx_cfg_set_deadzones(spnav_ctx *ctx, int first, int count, const int *delta);
+int spnav_ctx_cfg_get_deadzones(spnav_ctx *ctx, int first, int count, int *delta);
+int spnav_ctx_cfg_set_axismaps(spnav_ctx *ctx, int first, int count, const int *map);
+int spnav_ctx_cfg_get_axismaps(spnav_ctx *ctx, int first, int count, int *map);
+int spnav_ctx_cfg_set_bnmaps(spnav_ctx *ctx, int first, int count, const int *map);
+int spnav_ctx_cfg_get_bnmaps(spnav_ctx *ctx, int first, int count, int *map);
+int spnav_ctx_cfg_set_bnactions(spnav_ctx *ctx, int first, int count, const int *act);
+int spnav_ctx_cfg_get_bnactions(spnav_ctx *ctx, int first, int count, int *act);
+int spnav_ctx_cfg_set_kbmaps(spnav_ctx *ctx, int first, int count, const int *key);
+int spnav_ctx_cfg_get_kbmaps(spnav_ctx *ctx, int first, int count, int *key);
+int spnav_ctx_cfg_set_swapyz(spnav_ctx *ctx, int swap);
+int spnav_ctx_cfg_get_swapyz(spnav_ctx *ctx);
+int spnav_ctx_cfg_set_led(spnav_ctx *ctx, int state);
+int spnav_ctx_cfg_get_led(spnav_ctx *ctx);
+int spnav_ctx_cfg_set_grab(spnav_ctx *ctx, int state);
+int spnav_ctx_cfg_get_grab(spnav_ctx *ctx);
+int spnav_ctx_cfg_set_serial(spnav_ctx *ctx, const char *devpath);
+int spnav_ctx_cfg_get_serial(spnav_ctx *ctx, char *buf, int bufsz);
+int spnav_ctx_cfg_set_repeat(spnav_ctx *ctx, int msec);
+int spnav_ctx_cfg_get_repeat(spnav_ctx *ctx);
+int spnav_ctx_cfg_begin(spnav_ctx *ctx);
+int spnav_ctx_cfg_commit(spnav_ctx *ctx, int *status, int max);
+int spnav_ctx_profile_capture(spnav_ctx *ctx, struct spnav_profile *prof);
+int spnav_ctx_profile_apply(spnav_ctx *ctx, const struct spnav_profile *prof);
+
+int spnav_ctx_request_async(spnav_ctx *ctx, int req, const int *data, int timeout_ms,
+		spnav_request_callback cb, void *cls);
+int spnav_ctx_request_cancel(spnav_ctx *ctx, int token);
+int spnav_ctx_request_timeout(spnav_ctx *ctx);
+
 #ifdef __cplusplus
 }
 #endif
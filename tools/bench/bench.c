@@ -0,0 +1,463 @@
+/*
+bench - libspnav microbenchmarks
+Copyright (C) 2025 John Tsiombikas <nuclear@member.fsf.org>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+/* Microbenchmarks for the library hot paths. The library source is included
+ * directly, to get at the internal functions (proc_event, enqueue_event, ...).
+ * Each benchmark is calibrated to run for at least MIN_RUN_MSEC, and then run
+ * NUM_RUNS times. The output has one line per benchmark, with tab-separated
+ * fields: name, best ns/op, median ns/op, and operations per run. Lines
+ * starting with # are comments.
+ */
+#include "spnav.c"
+
+#define NUM_RUNS		7
+#define MIN_RUN_MSEC	50
+
+#define STREAM_LEN		1024
+#define STR_LEN			200
+
+struct benchmark {
+	const char *name;
+	/* performs count operations, and returns the time it took in nanoseconds */
+	double (*func)(long count);
+	long arg;
+};
+
+static int init_bench_ctx(int evq_size);
+static double elapsed_ns(const struct spnav_timestamp *start);
+
+static double bench_decode_motion(long count);
+static double bench_decode_mixed(long count);
+static double bench_enq_deq(long count);
+static double bench_enq_coalesce(long count);
+static double bench_remove_events(long count);
+static double bench_recv_str_buf(long count);
+static double bench_recv_str_alloc(long count);
+static double bench_moveobj(long count);
+static double bench_moveview(long count);
+static double bench_matrix_obj(long count);
+static double bench_matrix_view(long count);
+
+static struct benchmark benchmarks[] = {
+	{"proc_event.motion", bench_decode_motion},
+	{"proc_event.mixed", bench_decode_mixed},
+	{"evq.enqueue_dequeue", bench_enq_deq},
+	{"evq.enqueue_coalesce", bench_enq_coalesce},
+	{"remove_events.q256", bench_remove_events, 256},
+	{"remove_events.q4096", bench_remove_events, 4096},
+	{"recv_str.callerbuf", bench_recv_str_buf},
+	{"recv_str.alloc", bench_recv_str_alloc},
+	{"posrot_moveobj", bench_moveobj},
+	{"posrot_moveview", bench_moveview},
+	{"matrix_obj", bench_matrix_obj},
+	{"matrix_view", bench_matrix_view},
+	{0, 0}
+};
+
+static struct spnav_ctx ctx;
+static int bench_arg;
+static int32_t stream[STREAM_LEN][8];
+static struct reqresp strpkt[STR_LEN / REQSTR_CHUNK_SIZE + 1];
+static int num_strpkt;
+
+/* results go here, so that the compiler can't optimize the work away */
+static volatile int sink;
+static volatile float fsink;
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(double*)a;
+	double y = *(double*)b;
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+int main(int argc, char **argv)
+{
+	int i, j;
+	long count;
+	double t, res[NUM_RUNS];
+	struct benchmark *b;
+	char str[STR_LEN + 1];
+
+	/* synthetic event stream: mostly motion, with some button events */
+	for(i=0; i<STREAM_LEN; i++) {
+		memset(stream[i], 0, sizeof stream[i]);
+		if(i % 8 == 6) {
+			stream[i][0] = UEV_PRESS;
+			stream[i][1] = i & 0xf;
+		} else if(i % 8 == 7) {
+			stream[i][0] = UEV_RELEASE;
+			stream[i][1] = i & 0xf;
+		} else {
+			stream[i][0] = UEV_MOTION;
+			for(j=0; j<6; j++) {
+				stream[i][j + 1] = (i * 37 + j * 101) % 701 - 350;
+			}
+			stream[i][7] = 8;
+		}
+	}
+
+	/* chunked string response */
+	for(i=0; i<STR_LEN; i++) {
+		str[i] = 'a' + i % 26;
+	}
+	str[STR_LEN] = 0;
+	for(i=0; i * REQSTR_CHUNK_SIZE < STR_LEN; i++) {
+		memset(strpkt + i, 0, sizeof *strpkt);
+		strpkt[i].type = REQ_TAG | REQ_DEV_NAME;
+		j = STR_LEN - i * REQSTR_CHUNK_SIZE;
+		memcpy(strpkt[i].data, str + i * REQSTR_CHUNK_SIZE, j > REQSTR_CHUNK_SIZE ? REQSTR_CHUNK_SIZE : j);
+		strpkt[i].data[6] = i ? j | REQSTR_CONT_BIT : j;
+	}
+	num_strpkt = i;
+
+	printf("# libspnav microbenchmarks, %d runs per benchmark\n", NUM_RUNS);
+	printf("# name\tbest ns/op\tmedian ns/op\tops/run\n");
+
+	for(b=benchmarks; b->name; b++) {
+		if(argc > 1 && !strstr(b->name, argv[1])) {
+			continue;
+		}
+		bench_arg = b->arg;
+
+		/* calibrate, doubling the count until a run takes long enough */
+		count = 16;
+		while((t = b->func(count)) < MIN_RUN_MSEC * 1000000.0) {
+			count *= 2;
+		}
+
+		for(i=0; i<NUM_RUNS; i++) {
+			res[i] = b->func(count) / count;
+		}
+		qsort(res, NUM_RUNS, sizeof *res, cmp_double);
+
+		printf("%s\t%.2f\t%.2f\t%ld\n", b->name, res[0], res[NUM_RUNS / 2], count);
+		fflush(stdout);
+	}
+	return 0;
+}
+
+/* Sets up a context, which looks connected to the decoding and queueing code,
+ * with the other end of a socket pair, which never sends anything.
+ */
+static int init_bench_ctx(int evq_size)
+{
+	static int sv[2] = {-1, -1};
+
+	if(sv[0] == -1 && socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+		perror("socketpair");
+		abort();
+	}
+
+	free(ctx.evq);
+	init_ctx(&ctx);
+	ctx.sock = sv[0];
+	ctx.proto = 1;
+	ctx.evmask = SPNAV_EVMASK_DEFAULT;
+	ctx.evq_size = evq_size;
+	if(!(ctx.evq = malloc(evq_size * sizeof *ctx.evq))) {
+		perror("failed to allocate event queue");
+		abort();
+	}
+	reset_state(&ctx);
+	return 0;
+}
+
+static double elapsed_ns(const struct spnav_timestamp *start)
+{
+	struct spnav_timestamp now;
+	get_time(&now);
+	return (now.sec - start->sec) * 1e9 + (now.nsec - start->nsec);
+}
+
+static double bench_decode_motion(long count)
+{
+	long i;
+	int res = 0;
+	spnav_event ev;
+	struct spnav_timestamp t0;
+
+	init_bench_ctx(DEF_QUEUE_SIZE);
+
+	get_time(&t0);
+	for(i=0; i<count; i++) {
+		/* every eighth packet is a button event, skip those */
+		res += proc_event(&ctx, stream[(i + i / 6 * 2) & (STREAM_LEN - 1)], &ev);
+	}
+	sink = res;
+	return elapsed_ns(&t0);
+}
+
+static double bench_decode_mixed(long count)
+{
+	long i;
+	int res = 0;
+	spnav_event ev;
+	struct spnav_timestamp t0;
+
+	init_bench_ctx(DEF_QUEUE_SIZE);
+
+	get_time(&t0);
+	for(i=0; i<count; i++) {
+		res += proc_event(&ctx, stream[i & (STREAM_LEN - 1)], &ev);
+	}
+	sink = res;
+	return elapsed_ns(&t0);
+}
+
+/* decodes the stream into an array of events, to feed the queue benchmarks */
+static void decode_stream(spnav_event *evbuf)
+{
+	int i;
+	for(i=0; i<STREAM_LEN; i++) {
+		proc_event(&ctx, stream[i], evbuf + i);
+	}
+}
+
+static double bench_enq_deq(long count)
+{
+	long i;
+	int res = 0;
+	spnav_event ev;
+	static spnav_event evbuf[STREAM_LEN];
+	struct spnav_timestamp t0, ts = {0, 0};
+
+	init_bench_ctx(DEF_QUEUE_SIZE);
+	decode_stream(evbuf);
+
+	/* keep the queue half full */
+	for(i=0; i<DEF_QUEUE_SIZE / 2; i++) {
+		enqueue_event(&ctx, evbuf + i, &ts);
+	}
+
+	get_time(&t0);
+	for(i=0; i<count; i++) {
+		enqueue_event(&ctx, evbuf + (i & (STREAM_LEN - 1)), &ts);
+		dequeue_event(&ctx, &ev, 0);
+		res += ev.type;
+	}
+	sink = res;
+	return elapsed_ns(&t0);
+}
+
+static double bench_enq_coalesce(long count)
+{
+	long i;
+	int res = 0;
+	spnav_event ev;
+	static spnav_event evbuf[STREAM_LEN];
+	struct spnav_timestamp t0, ts = {0, 0};
+
+	init_bench_ctx(DEF_QUEUE_SIZE);
+	decode_stream(evbuf);
+	ctx.coalesce = SPNAV_COALESCE_WEIGHTED;
+
+	get_time(&t0);
+	for(i=0; i<count; i++) {
+		/* consecutive motion events are merged, drain the queue occasionally */
+		enqueue_event(&ctx, evbuf + (i & (STREAM_LEN - 1)), &ts);
+		if(ctx.evq_count >= DEF_QUEUE_SIZE / 2) {
+			while(ctx.evq_count) {
+				dequeue_event(&ctx, &ev, 0);
+				res += ev.type;
+			}
+		}
+	}
+	sink = res;
+	return elapsed_ns(&t0);
+}
+
+/* removes motion events from a full queue of bench_arg events. Refilling the
+ * queue is not included in the time.
+ */
+static double bench_remove_events(long count)
+{
+	long i;
+	int j, res = 0;
+	double t = 0;
+	static spnav_event evbuf[STREAM_LEN];
+	struct spnav_timestamp t0, ts = {0, 0};
+
+	init_bench_ctx(bench_arg);
+	decode_stream(evbuf);
+
+	for(i=0; i<count; i++) {
+		ctx.evq_rd = ctx.evq_count = 0;
+		for(j=0; j<bench_arg; j++) {
+			enqueue_event(&ctx, evbuf + (j & (STREAM_LEN - 1)), &ts);
+		}
+
+		get_time(&t0);
+		res += spnav_ctx_remove_events(&ctx, SPNAV_EVENT_MOTION);
+		t += elapsed_ns(&t0);
+	}
+	sink = res;
+	return t;
+}
+
+static double bench_recv_str_buf(long count)
+{
+	long i;
+	int j, res = 0;
+	char buf[STR_LEN + 1];
+	struct reqresp_strbuf sbuf = {0};
+	struct spnav_timestamp t0;
+
+	get_time(&t0);
+	for(i=0; i<count; i++) {
+		for(j=0; j<num_strpkt; j++) {
+			res += spnav_recv_str_buf(&sbuf, strpkt + j, buf, sizeof buf);
+		}
+	}
+	sink = res + buf[STR_LEN / 2];
+	return elapsed_ns(&t0);
+}
+
+static double bench_recv_str_alloc(long count)
+{
+	long i;
+	int j, res = 0;
+	struct reqresp_strbuf sbuf = {0};
+	struct spnav_timestamp t0;
+
+	get_time(&t0);
+	for(i=0; i<count; i++) {
+		for(j=0; j<num_strpkt; j++) {
+			res += spnav_recv_str(&sbuf, strpkt + j);
+		}
+	}
+	sink = res + sbuf.buf[STR_LEN / 2];
+	free(sbuf.buf);
+	return elapsed_ns(&t0);
+}
+
+/* the motion events for the posrot benchmarks are taken from the stream */
+static struct spnav_event_motion *stream_motion(int idx)
+{
+	static spnav_event evbuf[STREAM_LEN];
+	static int valid;
+	int i;
+
+	if(!valid) {
+		init_bench_ctx(DEF_QUEUE_SIZE);
+		for(i=0; i<STREAM_LEN; i++) {
+			proc_event(&ctx, stream[(i + i / 6 * 2) & (STREAM_LEN - 1)], evbuf + i);
+		}
+		valid = 1;
+	}
+	return &evbuf[idx & (STREAM_LEN - 1)].motion;
+}
+
+static double bench_moveobj(long count)
+{
+	long i;
+	struct spnav_posrot pr;
+	struct spnav_timestamp t0;
+
+	stream_motion(0);
+	spnav_posrot_init(&pr);
+
+	get_time(&t0);
+	for(i=0; i<count; i++) {
+		/* start over every now and then, to keep the values in a sane range */
+		if(!(i & (STREAM_LEN - 1))) {
+			spnav_posrot_init(&pr);
+		}
+		spnav_posrot_moveobj(&pr, stream_motion(i));
+	}
+	fsink = pr.rot[0] + pr.pos[0];
+	return elapsed_ns(&t0);
+}
+
+static double bench_moveview(long count)
+{
+	long i;
+	struct spnav_posrot pr;
+	struct spnav_timestamp t0;
+
+	stream_motion(0);
+	spnav_posrot_init(&pr);
+
+	get_time(&t0);
+	for(i=0; i<count; i++) {
+		if(!(i & (STREAM_LEN - 1))) {
+			spnav_posrot_init(&pr);
+		}
+		spnav_posrot_moveview(&pr, stream_motion(i));
+	}
+	fsink = pr.rot[0] + pr.pos[0];
+	return elapsed_ns(&t0);
+}
+
+/* a set of poses to build matrices from */
+static struct spnav_posrot *poses(void)
+{
+	static struct spnav_posrot pr[64];
+	static int valid;
+	int i;
+
+	if(!valid) {
+		spnav_posrot_init(pr);
+		for(i=1; i<64; i++) {
+			pr[i] = pr[i - 1];
+			spnav_posrot_moveobj(pr + i, stream_motion(i));
+		}
+		valid = 1;
+	}
+	return pr;
+}
+
+static double bench_matrix_obj(long count)
+{
+	long i;
+	float mat[16], sum = 0;
+	struct spnav_posrot *pr = poses();
+	struct spnav_timestamp t0;
+
+	get_time(&t0);
+	for(i=0; i<count; i++) {
+		spnav_matrix_obj(mat, pr + (i & 63));
+		sum += mat[12];
+	}
+	fsink = sum;
+	return elapsed_ns(&t0);
+}
+
+static double bench_matrix_view(long count)
+{
+	long i;
+	float mat[16], sum = 0;
+	struct spnav_posrot *pr = poses();
+	struct spnav_timestamp t0;
+
+	get_time(&t0);
+	for(i=0; i<count; i++) {
+		spnav_matrix_view(mat, pr + (i & 63));
+		sum += mat[12];
+	}
+	fsink = sum;
+	return elapsed_ns(&t0);
+}
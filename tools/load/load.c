@@ -0,0 +1,682 @@
+/*
+load - libspnav end-to-end latency and throughput test
+Copyright (C) 2025 John Tsiombikas <nuclear@member.fsf.org>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+/* End-to-end test of the event input path. For every run, a sender process
+ * is forked, which plays the part of the daemon on a temporary AF_UNIX socket,
+ * and sends motion events at a fixed rate, each one stamped with the time it
+ * was written. The client side uses the real library code, to receive them in
+ * one of several ways, and records the latency from the write to the moment
+ * the event is returned to the application.
+ *
+ * The sender never drops events. When the client doesn't keep up, and the
+ * socket buffer (or the shared memory ring) fills up, it waits until there's
+ * room, and counts the event as blocked. Events dropped by the client-side
+ * event queue are reported by spnav_queue_dropped.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include "spnav.h"
+#include "proto.h"
+
+#define DEF_DURATION	1.0
+#define RING_SIZE		1024
+#define BATCH_MAX		64
+/* give up on a run if nothing arrives for this long */
+#define STALL_MSEC		3000
+
+/* latency histogram: HIST_SUB linear buckets for every power of two of
+ * nanoseconds, which keeps the error of the percentiles under 1/HIST_SUB
+ */
+#define HIST_SUB_BITS	4
+#define HIST_SUB		(1 << HIST_SUB_BITS)
+#define HIST_SIZE		(40 * HIST_SUB)
+
+enum { MODE_WAIT, MODE_POLL, MODE_SPIN, MODE_BATCH, MODE_THREAD, NUM_MODES };
+static const char *mode_names[] = {"wait", "poll", "spin", "batch", "thread"};
+
+/* sender statistics, passed back through a pipe at the end of a run */
+struct sender_stats {
+	long sent, blocked;
+	double elapsed;		/* seconds */
+	int shm;			/* non-zero if the shared memory ring was used */
+};
+
+struct run_stats {
+	long recv, dropped;
+	int64_t min, max;
+	double sum;
+	unsigned long hist[HIST_SIZE];
+};
+
+static int run(int mode, long rate, struct sender_stats *sst, struct run_stats *rst);
+static void sender(int lsock, int statfd, long rate);
+static int64_t get_nsec(void);
+static void hist_add(struct run_stats *rst, int64_t ns);
+static int64_t hist_percentile(struct run_stats *rst, double p);
+static int64_t hist_bucket_value(int idx);
+static int parse_list(char *str, long *vals, int max, int modes);
+
+static char sock_path[108];
+static double duration = DEF_DURATION;
+static int use_shm;
+static int burst = 1;
+static int print_hist;
+
+static const char *usage_fmt = "Usage: %s [options]\n"
+	"Options:\n"
+	"  -m <modes>  comma-separated receive modes (default: all)\n"
+	"              wait: spnav_wait_event, poll: poll(2) + spnav_poll_event,\n"
+	"              spin: spnav_poll_event busy loop, batch: spnav_wait_events,\n"
+	"              thread: reader thread + spnav_wait_event\n"
+	"  -r <rates>  comma-separated event rates per second, 0 or max for as fast\n"
+	"              as possible (default: 1000,10000,100000,max)\n"
+	"  -t <sec>    duration of each run (default: 1)\n"
+	"  -b <count>  events per write (default: 1)\n"
+	"  -s          use the shared memory event transport\n"
+	"  -H          print the latency histogram of each run\n"
+	"  -h          print usage and exit\n";
+
+
+int main(int argc, char **argv)
+{
+	int i, j, num_modes = NUM_MODES, num_rates = 4;
+	long modes[NUM_MODES] = {MODE_WAIT, MODE_POLL, MODE_SPIN, MODE_BATCH, MODE_THREAD};
+	long rates[32] = {1000, 10000, 100000, 0};
+	struct sender_stats sst;
+	static struct run_stats rst;
+
+	for(i=1; i<argc; i++) {
+		if(argv[i][0] == '-' && argv[i][1] && !argv[i][2]) {
+			switch(argv[i][1]) {
+			case 'm':
+				if(!argv[++i] || (num_modes = parse_list(argv[i], modes, NUM_MODES, 1)) <= 0) {
+					goto inval;
+				}
+				continue;
+			case 'r':
+				if(!argv[++i] || (num_rates = parse_list(argv[i], rates, 32, 0)) <= 0) {
+					goto inval;
+				}
+				continue;
+			case 't':
+				if(!argv[++i] || (duration = atof(argv[i])) <= 0.0) goto inval;
+				continue;
+			case 'b':
+				if(!argv[++i] || (burst = atoi(argv[i])) <= 0 || burst > BATCH_MAX) goto inval;
+				continue;
+			case 's':
+				use_shm = 1;
+				continue;
+			case 'H':
+				print_hist = 1;
+				continue;
+			case 'h':
+				printf(usage_fmt, argv[0]);
+				return 0;
+			}
+		}
+inval:
+		fprintf(stderr, usage_fmt, argv[0]);
+		return 1;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	sprintf(sock_path, "/tmp/spnav-load-%d.sock", (int)getpid());
+	setenv("SPNAV_SOCKET", sock_path, 1);
+
+	printf("# libspnav end-to-end load test, %g sec per run, %d event(s) per write, %s transport\n",
+			duration, burst, use_shm ? "shared memory" : "socket");
+	printf("# latencies in microseconds, rate 0 means as fast as possible\n");
+	printf("# mode\trate\tsent\trecv\tdropped\tblocked\tevents/sec\tmin\tp50\tp99\tp999\tmax\n");
+
+	for(i=0; i<num_modes; i++) {
+		for(j=0; j<num_rates; j++) {
+			if(run(modes[i], rates[j], &sst, &rst) == -1) {
+				printf("%s\t%ld\tfailed\n", mode_names[modes[i]], rates[j]);
+				continue;
+			}
+			if(use_shm && !sst.shm) {
+				fprintf(stderr, "warning: shared memory transport not used, libspnav built without it?\n");
+			}
+
+			printf("%s\t%ld\t%ld\t%ld\t%ld\t%ld\t%.0f\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\n",
+					mode_names[modes[i]], rates[j], sst.sent, rst.recv, rst.dropped,
+					sst.blocked, rst.recv / sst.elapsed, rst.recv ? rst.min / 1000.0 : 0.0,
+					hist_percentile(&rst, 0.5) / 1000.0, hist_percentile(&rst, 0.99) / 1000.0,
+					hist_percentile(&rst, 0.999) / 1000.0, rst.max / 1000.0);
+
+			if(print_hist) {
+				int k;
+				printf("# histogram: bucket upper bound (usec), count\n");
+				for(k=0; k<HIST_SIZE; k++) {
+					if(rst.hist[k]) {
+						printf("#\t%.2f\t%lu\n", hist_bucket_value(k) / 1000.0, rst.hist[k]);
+					}
+				}
+			}
+			fflush(stdout);
+		}
+	}
+
+	unlink(sock_path);
+	return 0;
+}
+
+static int parse_list(char *str, long *vals, int max, int modes)
+{
+	int i, count = 0;
+	char *tok;
+
+	for(tok = strtok(str, ","); tok; tok = strtok(0, ",")) {
+		if(count >= max) return -1;
+
+		if(modes) {
+			for(i=0; i<NUM_MODES; i++) {
+				if(strcmp(tok, mode_names[i]) == 0) break;
+			}
+			if(i >= NUM_MODES) return -1;
+			vals[count++] = i;
+		} else {
+			if(strcmp(tok, "max") == 0) {
+				vals[count++] = 0;
+			} else {
+				if((vals[count] = atol(tok)) < 0) return -1;
+				count++;
+			}
+		}
+	}
+	return count;
+}
+
+/* terminator sent by the sender after the last event */
+#define IS_LAST(ev)	((ev)->type == SPNAV_EVENT_BUTTON && (ev)->button.bnum == -1)
+
+static int proc_event(struct run_stats *rst, spnav_event *ev, int64_t now)
+{
+	int64_t sent;
+
+	if(IS_LAST(ev)) return 1;
+	if(ev->type != SPNAV_EVENT_MOTION) return 0;
+
+	/* the send time is split in the x and y fields */
+	sent = ((int64_t)ev->motion.x << 32) | (uint32_t)ev->motion.y;
+	hist_add(rst, now - sent);
+	return 0;
+}
+
+/* waits for input on fd, returns 0 on timeout */
+static int wait_input(int fd)
+{
+	int res;
+	struct pollfd pfd;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	while((res = poll(&pfd, 1, STALL_MSEC)) == -1 && errno == EINTR);
+	return res > 0;
+}
+
+static int run(int mode, long rate, struct sender_stats *sst, struct run_stats *rst)
+{
+	int i, n, lsock, pfd[2], res = -1, done = 0;
+	pid_t pid;
+	int64_t now, last;
+	spnav_event ev, evbuf[BATCH_MAX];
+	struct sockaddr_un addr;
+
+	memset(rst, 0, sizeof *rst);
+	memset(sst, 0, sizeof *sst);
+
+	unlink(sock_path);
+	if((lsock = socket(PF_UNIX, SOCK_STREAM, 0)) == -1) {
+		perror("failed to create socket");
+		return -1;
+	}
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, sock_path);
+	if(bind(lsock, (struct sockaddr*)&addr, sizeof addr) == -1 || listen(lsock, 1) == -1) {
+		perror("failed to set up the listening socket");
+		close(lsock);
+		return -1;
+	}
+	if(pipe(pfd) == -1) {
+		perror("pipe failed");
+		close(lsock);
+		return -1;
+	}
+
+	if(!(pid = fork())) {
+		close(pfd[0]);
+		sender(lsock, pfd[1], rate);
+		_exit(0);
+	}
+	close(lsock);
+	close(pfd[1]);
+	if(pid == -1) {
+		perror("fork failed");
+		close(pfd[0]);
+		return -1;
+	}
+
+	if(spnav_open() == -1) {
+		fprintf(stderr, "failed to connect to the sender\n");
+		goto end;
+	}
+	if(mode == MODE_THREAD && spnav_reader_thread(1) == -1) {
+		fprintf(stderr, "failed to start the reader thread\n");
+		spnav_close();
+		goto end;
+	}
+
+	last = get_nsec();
+	while(!done) {
+		switch(mode) {
+		case MODE_WAIT:
+		case MODE_THREAD:
+			if(!spnav_wait_event(&ev)) {
+				done = -1;
+				break;
+			}
+			done = proc_event(rst, &ev, get_nsec());
+			break;
+
+		case MODE_POLL:
+			if(!wait_input(spnav_fd())) {
+				done = -1;
+				break;
+			}
+			while(!done && spnav_poll_event(&ev)) {
+				done = proc_event(rst, &ev, get_nsec());
+			}
+			break;
+
+		case MODE_SPIN:
+			if(spnav_poll_event(&ev)) {
+				now = get_nsec();
+				done = proc_event(rst, &ev, now);
+				last = now;
+			} else if(get_nsec() - last > STALL_MSEC * 1000000LL) {
+				done = -1;
+			}
+			break;
+
+		case MODE_BATCH:
+			if((n = spnav_wait_events(evbuf, BATCH_MAX)) <= 0) {
+				done = -1;
+				break;
+			}
+			now = get_nsec();
+			for(i=0; i<n && !done; i++) {
+				done = proc_event(rst, evbuf + i, now);
+			}
+			break;
+		}
+	}
+	if(done == -1) {
+		fprintf(stderr, "%s: the sender stopped sending events\n", mode_names[mode]);
+	}
+
+	rst->dropped = spnav_queue_dropped();
+	spnav_close();
+
+	if(read(pfd[0], sst, sizeof *sst) == sizeof *sst && done == 1) {
+		res = 0;
+	}
+
+end:
+	close(pfd[0]);
+	kill(pid, SIGTERM);
+	waitpid(pid, 0, 0);
+	return res;
+}
+
+
+/* ---- sender ---- */
+
+static struct shm_ring *ring;
+
+/* accepts the client and answers its protocol change request, passing it the
+ * shared memory ring if requested
+ */
+static int sender_connect(int lsock, struct sender_stats *sst)
+{
+	int s, fd = -1;
+	int32_t cmd;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} cbuf;
+
+	if((s = accept(lsock, 0, 0)) == -1) {
+		perror("sender: accept failed");
+		return -1;
+	}
+	if(read(s, &cmd, sizeof cmd) != sizeof cmd || (cmd & 0xffffff00) != (REQ_TAG | REQ_CHANGE_PROTO)) {
+		fprintf(stderr, "sender: unexpected handshake\n");
+		close(s);
+		return -1;
+	}
+
+	if(use_shm && (cmd & 0xff) >= 2) {
+#ifdef MFD_CLOEXEC
+		fd = memfd_create("spnav-load", MFD_CLOEXEC);
+#else
+		char name[64];
+		sprintf(name, "/spnav-load-%d", (int)getpid());
+		if((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) != -1) {
+			shm_unlink(name);
+		}
+#endif
+		if(fd == -1 || ftruncate(fd, SHM_RING_BYTES(RING_SIZE)) == -1 ||
+				(ring = mmap(0, SHM_RING_BYTES(RING_SIZE), PROT_READ | PROT_WRITE,
+							 MAP_SHARED, fd, 0)) == MAP_FAILED) {
+			perror("sender: failed to create the shared memory ring");
+			if(fd != -1) close(fd);
+			fd = -1;
+			ring = 0;
+		} else {
+			memset(ring, 0, SHM_RING_BYTES(RING_SIZE));
+			ring->magic = SHM_RING_MAGIC;
+			ring->size = RING_SIZE;
+		}
+	}
+
+	cmd = REQ_TAG | REQ_CHANGE_PROTO | (fd != -1 ? 2 : 1);
+	iov.iov_base = &cmd;
+	iov.iov_len = sizeof cmd;
+	memset(&msg, 0, sizeof msg);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	if(fd != -1) {
+		memset(&cbuf, 0, sizeof cbuf);
+		msg.msg_control = cbuf.buf;
+		msg.msg_controllen = sizeof cbuf.buf;
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof fd);
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof fd);
+	}
+	if(sendmsg(s, &msg, 0) != sizeof cmd) {
+		perror("sender: handshake failed");
+		close(s);
+		s = -1;
+	}
+	if(fd != -1) close(fd);
+
+	sst->shm = ring != 0;
+	return s;
+}
+
+/* answers any requests from the client with a failure status, so that it
+ * doesn't wait for them
+ */
+static void sender_serve(int s)
+{
+	int rd;
+	struct reqresp rr[16];
+
+	while((rd = recv(s, rr, sizeof rr, MSG_DONTWAIT)) > 0) {
+		/* packets might be split across reads, but we only need to keep the
+		 * client from waiting, so replying once per packet-sized read is enough
+		 */
+		for(; rd >= (int)sizeof *rr; rd -= sizeof *rr) {
+			struct reqresp resp = {0};
+			resp.type = rr[0].type | REQ_TAG;
+			resp.data[6] = -1;
+			write(s, &resp, sizeof resp);
+		}
+	}
+}
+
+/* writes packets to the socket, waiting for room if it's full. Returns 1 if
+ * it had to wait, 0 if not, -1 on failure.
+ */
+static int sender_write(int s, const void *buf, int sz)
+{
+	int wr, blocked = 0;
+	struct pollfd pfd;
+
+	while(sz > 0) {
+		if((wr = send(s, buf, sz, MSG_DONTWAIT)) == -1) {
+			if(errno == EINTR) continue;
+			if(errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+			blocked = 1;
+			pfd.fd = s;
+			pfd.events = POLLOUT;
+			poll(&pfd, 1, 100);
+			sender_serve(s);
+			continue;
+		}
+		buf = (const char*)buf + wr;
+		sz -= wr;
+	}
+	return blocked;
+}
+
+/* writes events to the shared memory ring, waiting for room if it's full */
+static int sender_ring_write(int s, int32_t (*pkt)[8], int count)
+{
+	int i, blocked = 0;
+	uint32_t wr, rd, first;
+	int32_t wake[8] = {UEV_SHM_WAKE};
+
+	first = wr = ring->wr;
+	for(i=0; i<count; i++) {
+		while(wr - (rd = __atomic_load_n(&ring->rd, __ATOMIC_ACQUIRE)) >= RING_SIZE) {
+			/* publish what we have so far, and give the client a chance */
+			if(wr != ring->wr) {
+				__atomic_store_n(&ring->wr, wr, __ATOMIC_SEQ_CST);
+				if(__atomic_load_n(&ring->rd, __ATOMIC_SEQ_CST) == first) {
+					sender_write(s, wake, sizeof wake);
+				}
+				first = wr;
+			}
+			blocked = 1;
+			sched_yield();
+		}
+		memcpy(ring->ev[wr++ & (RING_SIZE - 1)], pkt[i], sizeof *ring->ev);
+	}
+	__atomic_store_n(&ring->wr, wr, __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&ring->rd, __ATOMIC_SEQ_CST) == first) {
+		if(sender_write(s, wake, sizeof wake) > 0) blocked = 1;
+	}
+	return blocked;
+}
+
+static void sender_sleep_until(int64_t t)
+{
+	int64_t dt;
+	struct timespec ts;
+
+	/* sleep for most of it, and spin for the rest, for accurate pacing */
+	while((dt = t - get_nsec()) > 0) {
+		if(dt > 200000) {
+			dt -= 100000;
+			ts.tv_sec = dt / 1000000000;
+			ts.tv_nsec = dt % 1000000000;
+			nanosleep(&ts, 0);
+		}
+	}
+}
+
+static void sender(int lsock, int statfd, long rate)
+{
+	int i, s, res;
+	long seq = 0;
+	int64_t start, now, end;
+	int32_t pkt[BATCH_MAX][8];
+	struct sender_stats sst;
+	char c;
+
+	memset(&sst, 0, sizeof sst);
+	if((s = sender_connect(lsock, &sst)) == -1) {
+		return;
+	}
+	close(lsock);
+
+	/* let the client settle down after connecting */
+	sender_sleep_until(get_nsec() + 20000000);
+	sender_serve(s);
+
+	start = get_nsec();
+	end = start + (int64_t)(duration * 1e9);
+
+	for(;;) {
+		if(rate > 0) {
+			sender_sleep_until(start + (int64_t)(seq * 1e9 / rate));
+		}
+		if((now = get_nsec()) >= end) break;
+
+		for(i=0; i<burst; i++) {
+			memset(pkt[i], 0, sizeof pkt[i]);
+			pkt[i][0] = UEV_MOTION;
+			pkt[i][1] = (int32_t)(now >> 32);
+			pkt[i][2] = (int32_t)now;
+			pkt[i][3] = seq + i;
+		}
+
+		if(ring) {
+			res = sender_ring_write(s, pkt, burst);
+		} else {
+			res = sender_write(s, pkt, burst * sizeof *pkt);
+		}
+		if(res == -1) break;
+		if(res > 0) sst.blocked += burst;
+		seq += burst;
+
+		if(!(seq & 0xff)) {
+			sender_serve(s);
+		}
+	}
+	sst.sent = seq;
+	sst.elapsed = (get_nsec() - start) / 1e9;
+
+	/* terminator */
+	memset(pkt[0], 0, sizeof pkt[0]);
+	pkt[0][0] = UEV_PRESS;
+	pkt[0][1] = -1;
+	if(ring) {
+		sender_ring_write(s, pkt, 1);
+	} else {
+		sender_write(s, pkt, sizeof *pkt);
+	}
+
+	write(statfd, &sst, sizeof sst);
+
+	/* wait for the client to hang up */
+	while(read(s, &c, 1) > 0);
+	close(s);
+}
+
+
+/* ---- helpers ---- */
+
+static int64_t get_nsec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int hist_index(int64_t ns)
+{
+	int exp = 0;
+	uint64_t v = ns < 0 ? 0 : ns;
+
+	if(v < HIST_SUB) {
+		return (int)v;
+	}
+	while((v >> exp) >= 2 * HIST_SUB) {
+		exp++;
+	}
+	/* v >> exp is in [HIST_SUB, 2 * HIST_SUB) */
+	return (exp + 1) * HIST_SUB + (int)(v >> exp) - HIST_SUB;
+}
+
+/* upper bound of the values in bucket idx */
+static int64_t hist_bucket_value(int idx)
+{
+	int exp = idx / HIST_SUB - 1;
+	int64_t sub = idx % HIST_SUB;
+
+	if(exp < 0) {
+		return idx;
+	}
+	return ((HIST_SUB + sub + 1) << exp) - 1;
+}
+
+static void hist_add(struct run_stats *rst, int64_t ns)
+{
+	int idx = hist_index(ns);
+
+	if(idx >= HIST_SIZE) idx = HIST_SIZE - 1;
+	rst->hist[idx]++;
+
+	if(!rst->recv || ns < rst->min) rst->min = ns;
+	if(!rst->recv || ns > rst->max) rst->max = ns;
+	rst->sum += ns;
+	rst->recv++;
+}
+
+static int64_t hist_percentile(struct run_stats *rst, double p)
+{
+	int i;
+	unsigned long count = 0, target;
+
+	if(!rst->recv) return 0;
+
+	target = (unsigned long)(p * rst->recv);
+	if(target >= rst->recv) target = rst->recv - 1;
+
+	for(i=0; i<HIST_SIZE; i++) {
+		count += rst->hist[i];
+		if(count > target) {
+			return hist_bucket_value(i) < rst->max ? hist_bucket_value(i) : rst->max;
+		}
+	}
+	return rst->max;
+}
@@ -0,0 +1,1201 @@
+/*
+refd - minimal reference spacenav daemon, for testing libspnav without spacenavd
+Copyright (C) 2025 John Tsiombikas <nuclear@member.fsf.org>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+/* The reference daemon speaks the spacenav protocol v0, v1, and v2 with the
+ * shared memory event transport, over an AF_UNIX socket. It emulates a single
+ * 6dof device, which produces synthetic motion, or replays a script, at a fixed
+ * rate, and keeps the configuration in memory. It's meant as a mock spacenavd
+ * for testing and load scenarios, so the event stream is deterministic, and it
+ * can misbehave on purpose: delay responses, split packets across writes, or
+ * pretend to only know protocol v0.
+ *
+ * Everything written to a client socket goes through two queues: one for
+ * events, and one for request responses, which might be delayed. Packets are
+ * never interleaved, even when they're split. Events which don't fit in the
+ * event queue, because the client isn't reading them, are dropped.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include "spnav.h"
+#include "proto.h"
+
+#define DEF_SOCK_PATH	"/var/run/spnav.sock"
+#define MAX_CLIENTS		32
+#define DEF_RING_SIZE	1024
+/* socket output queue sizes, in packets */
+#define EVQ_SIZE		4096
+#define RESPQ_SIZE		1024
+/* clients which don't say anything for this long are protocol v0 clients */
+#define PROTO_WAIT_MSEC	500
+
+#define NUM_AXES		6
+#define NUM_BUTTONS		2
+#define DEV_NAME_STR	"libspnav reference daemon virtual device"
+#define DEV_PATH_STR	"/dev/null"
+
+#define CFG_TABLE_SIZE	64
+#define MAX_SCRIPT_LINE	256
+
+/* times are in microseconds since startup */
+struct outpkt {
+	double due;
+	int32_t data[8];
+};
+
+struct pktqueue {
+	struct outpkt pkt[RESPQ_SIZE > EVQ_SIZE ? RESPQ_SIZE : EVQ_SIZE];
+	int size, rd, count;
+};
+
+struct client {
+	int s;
+	int proto;			/* -1 until the client sends anything */
+	double conn_time;
+	unsigned int evmask;
+	int32_t sens;
+	char *name;
+	struct reqresp_strbuf strbuf;
+	char inbuf[sizeof(struct reqresp)];
+	int inlen;
+
+	/* output queues, and the packet being written (cur_off is -1 if none).
+	 * A split packet is written up to cur_split first, and the rest after
+	 * cur_resume.
+	 */
+	struct pktqueue *evq, *respq;
+	struct outpkt cur;
+	int cur_off, cur_split, cur_paused;
+	double cur_resume;
+	int want_write;
+	unsigned int split_seq;
+
+	/* statistics */
+	unsigned long sent, dropped;
+	int max_backlog;
+
+	/* shared memory event ring (protocol v2) */
+	struct shm_ring *ring;
+	unsigned int ring_size;
+	size_t ring_len;
+};
+
+/* configuration state. Values are kept in the protocol representation,
+ * floats included, since they're only ever passed back to clients.
+ */
+struct config {
+	int32_t sens, sens_axis[6];
+	int32_t invert[6];
+	int32_t swapyz, led, grab, repeat;
+	int32_t deadzone[CFG_TABLE_SIZE], axismap[CFG_TABLE_SIZE];
+	int32_t bnmap[CFG_TABLE_SIZE], bnaction[CFG_TABLE_SIZE], kbmap[CFG_TABLE_SIZE];
+	char serdev[256];
+};
+
+/* script items are either event packets, or pauses */
+struct script_item {
+	int32_t pkt[8];
+	long pause;			/* microseconds, 0 for events */
+};
+
+static int init(const char *path);
+static void cleanup(void);
+static void accept_client(void);
+static void drop_client(struct client *c);
+static int proc_input(struct client *c);
+static int handshake(struct client *c, int ver);
+static void proc_request(struct client *c, struct reqresp *req);
+static void send_resp(struct client *c, int req, struct reqresp *rr, int status);
+static void send_str(struct client *c, int req, const char *str);
+static void send_event(struct client *c, const int32_t *pkt);
+static int flush_output(struct client *c, double now);
+static double next_output(struct client *c);
+static void broadcast(const int32_t *pkt);
+static void gen_events(double now);
+static int load_script(const char *fname);
+static int create_ring(struct client *c);
+static void default_config(struct config *cfg);
+static double get_usec(void);
+static void sighandler(int s);
+
+static const char *sock_path;
+static int lsock = -1;
+static struct client clients[MAX_CLIENTS];
+static int num_clients;
+
+static struct config cfg, saved_cfg;
+
+static int use_shm = 1;
+static int ring_size = DEF_RING_SIZE;
+static int rate = 100;
+static unsigned long max_events;
+static int loop_script;
+static int verbose;
+static int once;
+static volatile int quit;
+
+/* fault injection */
+static long resp_delay;		/* microseconds */
+static long split_gap = -1;	/* microseconds, -1 to disable */
+static int proto0_only;
+
+static struct script_item *script;
+static int script_len, script_pos;
+
+/* event stream state. The stream starts when the first client is ready */
+static int stream_state;	/* 0: not started, 1: running, 2: done */
+static double next_ev;
+static unsigned long gen_count;
+static int served;
+
+static const char *usage_fmt = "Usage: %s [options]\n"
+	"Options:\n"
+	"  -s <path>   socket path (default: $SPNAV_SOCKET or " DEF_SOCK_PATH ")\n"
+	"  -r <rate>   events per second, 0 to disable (default: 100)\n"
+	"  -c <count>  stop after generating count events\n"
+	"  -f <file>   replay events from a script, instead of synthetic motion\n"
+	"  -l          loop the script\n"
+	"  -q <size>   shared memory ring size in events, power of two (default: 1024)\n"
+	"  -n          disable the shared memory event transport\n"
+	"  -d <msec>   delay all request responses by msec\n"
+	"  -p <usec>   split every packet in two writes, usec apart (0: back to back)\n"
+	"  -0          only speak protocol v0 (ignore protocol change requests)\n"
+	"  -1          exit when the last client disconnects\n"
+	"  -v          verbose output\n"
+	"  -h          print usage and exit\n"
+	"\n"
+	"Script lines are one of:\n"
+	"  m <tx> <ty> <tz> <rx> <ry> <rz> [period]   motion event\n"
+	"  p <button>                                 button press\n"
+	"  r <button>                                 button release\n"
+	"  w <usec>                                   pause\n"
+	"Each event takes one event period (1/rate), pauses are in addition to that.\n"
+	"Empty lines and lines starting with # are ignored.\n";
+
+
+int main(int argc, char **argv)
+{
+	int i, n, tmo;
+	double now, next, t;
+	struct pollfd pfd[MAX_CLIENTS + 1];
+
+	if(!(sock_path = getenv("SPNAV_SOCKET"))) {
+		sock_path = DEF_SOCK_PATH;
+	}
+
+	for(i=1; i<argc; i++) {
+		if(argv[i][0] == '-' && argv[i][1] && !argv[i][2]) {
+			switch(argv[i][1]) {
+			case 's':
+				if(!argv[++i]) goto inval;
+				sock_path = argv[i];
+				continue;
+			case 'r':
+				if(!argv[++i] || (rate = atoi(argv[i])) < 0) goto inval;
+				continue;
+			case 'c':
+				if(!argv[++i]) goto inval;
+				max_events = strtoul(argv[i], 0, 10);
+				continue;
+			case 'f':
+				if(!argv[++i] || load_script(argv[i]) == -1) goto inval;
+				continue;
+			case 'l':
+				loop_script = 1;
+				continue;
+			case 'q':
+				if(!argv[++i]) goto inval;
+				ring_size = atoi(argv[i]);
+				if(ring_size <= 0 || (ring_size & (ring_size - 1))) goto inval;
+				continue;
+			case 'n':
+				use_shm = 0;
+				continue;
+			case 'd':
+				if(!argv[++i] || (resp_delay = atol(argv[i]) * 1000) < 0) goto inval;
+				continue;
+			case 'p':
+				if(!argv[++i] || (split_gap = atol(argv[i])) < 0) goto inval;
+				continue;
+			case '0':
+				proto0_only = 1;
+				continue;
+			case '1':
+				once = 1;
+				continue;
+			case 'v':
+				verbose = 1;
+				continue;
+			case 'h':
+				printf(usage_fmt, argv[0]);
+				return 0;
+			}
+		}
+inval:
+		fprintf(stderr, usage_fmt, argv[0]);
+		return 1;
+	}
+
+	if(init(sock_path) == -1) {
+		return 1;
+	}
+
+	while(!quit) {
+		now = get_usec();
+
+		/* wake up in time for the next event, the next delayed write, or to
+		 * give up waiting for a handshake
+		 */
+		next = -1;
+		if(stream_state == 1) {
+			next = next_ev;
+		}
+		for(i=0; i<num_clients; i++) {
+			t = clients[i].proto < 0 ? clients[i].conn_time + PROTO_WAIT_MSEC * 1000.0 :
+				next_output(clients + i);
+			if(t >= 0 && (next < 0 || t < next)) {
+				next = t;
+			}
+		}
+		if(next < 0) {
+			tmo = -1;
+		} else {
+			tmo = next > now ? (int)((next - now + 999.0) / 1000.0) : 0;
+		}
+
+		pfd[0].fd = lsock;
+		pfd[0].events = POLLIN;
+		for(i=0; i<num_clients; i++) {
+			pfd[i + 1].fd = clients[i].s;
+			pfd[i + 1].events = POLLIN | (clients[i].want_write ? POLLOUT : 0);
+		}
+		n = num_clients;
+
+		if(poll(pfd, n + 1, tmo) == -1) {
+			if(errno == EINTR) continue;
+			perror("poll");
+			break;
+		}
+
+		/* handle client input first, so that we don't send events to clients
+		 * which are about to ask for a protocol change
+		 */
+		for(i=n-1; i>=0; i--) {
+			if(pfd[i + 1].revents & POLLOUT) {
+				clients[i].want_write = 0;
+			}
+			if(pfd[i + 1].revents & ~POLLOUT) {
+				if(proc_input(clients + i) == -1) {
+					drop_client(clients + i);
+				}
+			}
+		}
+		if(pfd[0].revents & POLLIN) {
+			accept_client();
+		}
+		if(once && served && !num_clients) {
+			break;
+		}
+
+		now = get_usec();
+		for(i=0; i<num_clients; i++) {
+			if(clients[i].proto < 0 && now - clients[i].conn_time >= PROTO_WAIT_MSEC * 1000.0) {
+				if(verbose) printf("client %d: protocol v0\n", clients[i].s);
+				clients[i].proto = 0;
+			}
+			if(clients[i].proto >= 0 && !stream_state) {
+				stream_state = 1;
+				next_ev = now;
+			}
+		}
+		gen_events(now);
+
+		now = get_usec();
+		for(i=num_clients-1; i>=0; i--) {
+			if(flush_output(clients + i, now) == -1) {
+				drop_client(clients + i);
+			}
+		}
+	}
+
+	cleanup();
+	return 0;
+}
+
+static int init(const char *path)
+{
+	struct sockaddr_un addr;
+
+	if(strlen(path) >= sizeof addr.sun_path) {
+		fprintf(stderr, "socket path too long: %s\n", path);
+		return -1;
+	}
+
+	if((lsock = socket(PF_UNIX, SOCK_STREAM, 0)) == -1) {
+		perror("failed to create socket");
+		return -1;
+	}
+	unlink(path);
+
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if(bind(lsock, (struct sockaddr*)&addr, sizeof addr) == -1) {
+		fprintf(stderr, "failed to bind socket %s: %s\n", path, strerror(errno));
+		close(lsock);
+		return -1;
+	}
+	if(listen(lsock, 16) == -1) {
+		perror("listen failed");
+		close(lsock);
+		unlink(path);
+		return -1;
+	}
+
+	signal(SIGINT, sighandler);
+	signal(SIGTERM, sighandler);
+	signal(SIGPIPE, SIG_IGN);
+
+	default_config(&cfg);
+	saved_cfg = cfg;
+	get_usec();		/* start the clock */
+
+	if(verbose) {
+		printf("listening on %s, event rate: %d/sec, shared memory transport: %s\n",
+				path, rate, use_shm ? "enabled" : "disabled");
+	}
+	return 0;
+}
+
+static void cleanup(void)
+{
+	while(num_clients > 0) {
+		drop_client(clients + num_clients - 1);
+	}
+	close(lsock);
+	unlink(sock_path);
+}
+
+static void accept_client(void)
+{
+	int s;
+	struct client *c;
+
+	if((s = accept(lsock, 0, 0)) == -1) {
+		perror("accept failed");
+		return;
+	}
+	if(num_clients >= MAX_CLIENTS) {
+		fprintf(stderr, "too many clients, dropping new connection\n");
+		close(s);
+		return;
+	}
+
+	c = clients + num_clients;
+	memset(c, 0, sizeof *c);
+	if(!(c->evq = malloc(sizeof *c->evq)) || !(c->respq = malloc(sizeof *c->respq))) {
+		fprintf(stderr, "failed to allocate output queues\n");
+		free(c->evq);
+		close(s);
+		return;
+	}
+	c->evq->size = EVQ_SIZE;
+	c->respq->size = RESPQ_SIZE;
+	c->evq->rd = c->evq->count = c->respq->rd = c->respq->count = 0;
+	c->cur_off = -1;
+
+	c->s = s;
+	c->proto = -1;
+	c->conn_time = get_usec();
+	c->evmask = SPNAV_EVMASK_INPUT;
+	c->sens = cfg.sens;
+	num_clients++;
+	served = 1;
+
+	if(verbose) printf("client %d: connected\n", s);
+}
+
+static void drop_client(struct client *c)
+{
+	if(verbose) {
+		printf("client %d: disconnected. events sent: %lu, dropped: %lu (ring: %lu),"
+				" max backlog: %d\n", c->s, c->sent, c->dropped,
+				c->ring ? (unsigned long)c->ring->dropped : 0, c->max_backlog);
+	}
+
+	close(c->s);
+	free(c->evq);
+	free(c->respq);
+	if(c->ring) {
+		munmap(c->ring, c->ring_len);
+	}
+	free(c->name);
+	free(c->strbuf.buf);
+
+	*c = clients[--num_clients];
+}
+
+/* Reads whatever the client sent, and processes every complete request.
+ * Returns -1 if the client should be dropped.
+ */
+static int proc_input(struct client *c)
+{
+	int rd, sz, ver;
+	int32_t cmd;
+	float fsens;
+
+	for(;;) {
+		/* protocol v0 clients, and clients which haven't asked for a protocol
+		 * change yet, send 4 byte commands (sensitivity, or protocol change)
+		 */
+		sz = c->proto >= 1 ? sizeof(struct reqresp) : sizeof cmd;
+
+		while((rd = recv(c->s, c->inbuf + c->inlen, sz - c->inlen, MSG_DONTWAIT)) == -1 &&
+				errno == EINTR);
+		if(rd == 0) return -1;
+		if(rd == -1) {
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+		}
+		if((c->inlen += rd) < sz) {
+			continue;
+		}
+		c->inlen = 0;
+
+		if(c->proto >= 1) {
+			proc_request(c, (struct reqresp*)c->inbuf);
+			continue;
+		}
+
+		memcpy(&cmd, c->inbuf, sizeof cmd);
+		/* an old daemon would take it as a sensitivity value, like any other */
+		if((cmd & 0xffffff00) == (REQ_TAG | REQ_CHANGE_PROTO) && !proto0_only) {
+			ver = cmd & 0xff;
+			if(handshake(c, ver > MAX_PROTO_VER ? MAX_PROTO_VER : ver) == -1) {
+				return -1;
+			}
+			continue;
+		}
+
+		/* v0 sensitivity command */
+		c->proto = 0;
+		c->sens = cmd;
+		if(verbose) {
+			memcpy(&fsens, &cmd, sizeof fsens);
+			printf("client %d: sensitivity %g\n", c->s, fsens);
+		}
+	}
+}
+
+/* Responds to a protocol change request. For protocol v2, the shared memory
+ * ring is passed to the client along with the response, unless it's disabled.
+ */
+static int handshake(struct client *c, int ver)
+{
+	int32_t resp;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} cbuf;
+	int fd = -1;
+
+	if(ver >= 2 && use_shm) {
+		fd = create_ring(c);
+	}
+
+	resp = REQ_TAG | REQ_CHANGE_PROTO | ver;
+	iov.iov_base = &resp;
+	iov.iov_len = sizeof resp;
+	memset(&msg, 0, sizeof msg);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if(fd != -1) {
+		memset(&cbuf, 0, sizeof cbuf);
+		msg.msg_control = cbuf.buf;
+		msg.msg_controllen = sizeof cbuf.buf;
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof fd);
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof fd);
+	}
+
+	if(sendmsg(c->s, &msg, 0) != sizeof resp) {
+		if(fd != -1) close(fd);
+		return -1;
+	}
+	if(fd != -1) close(fd);
+
+	c->proto = ver;
+	if(ver >= 1) {
+		c->evmask = SPNAV_EVMASK_DEFAULT;
+	}
+	if(verbose) {
+		printf("client %d: protocol v%d%s\n", c->s, ver, c->ring ? " (shared memory events)" : "");
+	}
+	return 0;
+}
+
+/* Creates the shared memory event ring for a client, and returns a file
+ * descriptor for it, to be passed to the client, or -1 on failure. If that
+ * happens, events are sent through the socket.
+ */
+static int create_ring(struct client *c)
+{
+	int fd;
+	size_t len;
+	struct shm_ring *ring;
+
+	len = SHM_RING_BYTES(ring_size);
+
+#ifdef MFD_CLOEXEC
+	if((fd = memfd_create("spnav-ring", MFD_CLOEXEC)) == -1) {
+		perror("memfd_create failed");
+		return -1;
+	}
+#else
+	{
+		char name[64];
+		sprintf(name, "/spnav-ring-%d-%d", (int)getpid(), c->s);
+		if((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) == -1) {
+			perror("shm_open failed");
+			return -1;
+		}
+		shm_unlink(name);
+	}
+#endif
+
+	if(ftruncate(fd, len) == -1) {
+		perror("failed to resize shared memory object");
+		close(fd);
+		return -1;
+	}
+	if((ring = mmap(0, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		perror("failed to map shared memory object");
+		close(fd);
+		return -1;
+	}
+
+	memset(ring, 0, len);
+	ring->magic = SHM_RING_MAGIC;
+	ring->size = ring_size;
+
+	c->ring = ring;
+	c->ring_size = ring_size;
+	c->ring_len = len;
+	return fd;
+}
+
+static int queue_push(struct pktqueue *q, const void *pkt, double due)
+{
+	struct outpkt *op;
+
+	if(q->count >= q->size) {
+		return -1;
+	}
+	op = q->pkt + (q->rd + q->count++) % q->size;
+	op->due = due;
+	memcpy(op->data, pkt, sizeof op->data);
+	return 0;
+}
+
+/* Queues a response packet, to be sent after the configured delay */
+static void queue_resp(struct client *c, const struct reqresp *rr)
+{
+	if(queue_push(c->respq, rr, get_usec() + resp_delay) == -1) {
+		fprintf(stderr, "client %d: too many pending responses, dropping one\n", c->s);
+	}
+}
+
+static void send_resp(struct client *c, int req, struct reqresp *rr, int status)
+{
+	rr->type = REQ_TAG | req;
+	rr->data[6] = status;
+	queue_resp(c, rr);
+}
+
+/* Sends a string response in 24 byte chunks. The first one carries the string
+ * length, and the rest the remaining length, with REQSTR_CONT_BIT set.
+ */
+static void send_str(struct client *c, int req, const char *str)
+{
+	int len, sz;
+	struct reqresp rr;
+
+	len = strlen(str);
+	rr.data[6] = len;
+	do {
+		sz = len > REQSTR_CHUNK_SIZE ? REQSTR_CHUNK_SIZE : len;
+		memset(rr.data, 0, 6 * sizeof *rr.data);
+		memcpy(rr.data, str, sz);
+		rr.type = REQ_TAG | req;
+		queue_resp(c, &rr);
+
+		str += sz;
+		len -= sz;
+		rr.data[6] = len | REQSTR_CONT_BIT;
+	} while(len > 0);
+}
+
+/* Writes as much of the queued output as the socket takes without blocking.
+ * Delayed responses are written when they're due, and events in the meantime.
+ * Returns -1 if the client should be dropped.
+ */
+static int flush_output(struct client *c, double now)
+{
+	int wr, end;
+	struct pktqueue *q;
+
+	for(;;) {
+		if(c->cur_off < 0) {
+			/* pick the next packet to write */
+			q = c->respq;
+			if(!q->count || q->pkt[q->rd].due > now) {
+				q = c->evq;
+				if(!q->count) return 0;
+			}
+			c->cur = q->pkt[q->rd];
+			q->rd = (q->rd + 1) % q->size;
+			q->count--;
+
+			c->cur_off = c->cur_paused = 0;
+			c->cur_split = sizeof c->cur.data;
+			if(split_gap >= 0) {
+				c->cur_split = 1 + c->split_seq++ % (sizeof c->cur.data - 1);
+			}
+		}
+		if(c->cur_paused && now < c->cur_resume) {
+			return 0;
+		}
+
+		end = c->cur_off < c->cur_split ? c->cur_split : sizeof c->cur.data;
+		if((wr = send(c->s, (char*)c->cur.data + c->cur_off, end - c->cur_off, MSG_DONTWAIT)) == -1) {
+			if(errno == EINTR) continue;
+			if(errno == EAGAIN || errno == EWOULDBLOCK) {
+				c->want_write = 1;
+				return 0;
+			}
+			return -1;
+		}
+		c->cur_off += wr;
+
+		if(c->cur_off >= sizeof c->cur.data) {
+			c->cur_off = -1;
+			continue;
+		}
+		if(c->cur_off == c->cur_split && !c->cur_paused) {
+			c->cur_paused = 1;
+			c->cur_resume = now + split_gap;
+		}
+	}
+}
+
+/* Returns the time when there's going to be something to write, which can't
+ * be written right now, or -1 if there isn't anything like that.
+ */
+static double next_output(struct client *c)
+{
+	if(c->cur_off >= 0) {
+		return c->cur_paused ? c->cur_resume : -1;
+	}
+	if(c->respq->count && !c->evq->count) {
+		return c->respq->pkt[c->respq->rd].due;
+	}
+	return -1;
+}
+
+/* event mask bit for each event type */
+static unsigned int evmask_bit(int type)
+{
+	switch(type) {
+	case UEV_MOTION:
+		return SPNAV_EVMASK_MOTION;
+	case UEV_PRESS:
+	case UEV_RELEASE:
+		return SPNAV_EVMASK_BUTTON;
+	case UEV_DEV:
+		return SPNAV_EVMASK_DEV;
+	case UEV_CFG:
+		return SPNAV_EVMASK_CFG;
+	case UEV_RAWAXIS:
+		return SPNAV_EVMASK_RAWAXIS;
+	case UEV_RAWBUTTON:
+		return SPNAV_EVMASK_RAWBUTTON;
+	default:
+		break;
+	}
+	return 0;
+}
+
+static void send_event(struct client *c, const int32_t *pkt)
+{
+	unsigned int rd, wr;
+	struct shm_ring *ring;
+	int32_t wake[8] = {0};
+
+	if(c->proto < 0 || !(c->evmask & evmask_bit(pkt[0]))) {
+		return;
+	}
+	/* protocol v0 clients only get input events */
+	if(c->proto == 0 && pkt[0] != UEV_MOTION && pkt[0] != UEV_PRESS && pkt[0] != UEV_RELEASE) {
+		return;
+	}
+
+	if(!(ring = c->ring)) {
+		if(queue_push(c->evq, pkt, 0) == -1) {
+			c->dropped++;
+			return;
+		}
+		c->sent++;
+		if(c->evq->count > c->max_backlog) {
+			c->max_backlog = c->evq->count;
+		}
+		return;
+	}
+
+	wr = ring->wr;
+	rd = __atomic_load_n(&ring->rd, __ATOMIC_ACQUIRE);
+	if(wr - rd >= c->ring_size) {
+		__atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+		return;
+	}
+	memcpy(ring->ev[wr & (c->ring_size - 1)], pkt, sizeof *ring->ev);
+	__atomic_store_n(&ring->wr, wr + 1, __ATOMIC_SEQ_CST);
+	c->sent++;
+	if(wr + 1 - rd > c->max_backlog) {
+		c->max_backlog = wr + 1 - rd;
+	}
+
+	/* if the client had consumed everything before this one, it might be
+	 * waiting on the socket (see proto.h)
+	 */
+	if(__atomic_load_n(&ring->rd, __ATOMIC_SEQ_CST) == wr) {
+		/* if the socket queue is full, the client will wake up anyway */
+		wake[0] = UEV_SHM_WAKE;
+		queue_push(c->evq, wake, 0);
+	}
+}
+
+static void broadcast(const int32_t *pkt)
+{
+	int i;
+	for(i=0; i<num_clients; i++) {
+		send_event(clients + i, pkt);
+	}
+}
+
+/* Generates all events due by now. Synthetic motion is a set of sine waves,
+ * with a button press and release every 100 motion events.
+ */
+static void gen_events(double now)
+{
+	int i;
+	double t;
+	int32_t pkt[8];
+	struct script_item *item;
+
+	if(stream_state != 1 || rate <= 0) return;
+
+	while(next_ev <= now) {
+		if(max_events && gen_count >= max_events) {
+			stream_state = 2;
+			break;
+		}
+
+		if(script) {
+			if(script_pos >= script_len) {
+				if(!loop_script) {
+					stream_state = 2;
+					break;
+				}
+				script_pos = 0;
+			}
+			item = script + script_pos++;
+			if(item->pause) {
+				next_ev += item->pause;
+				continue;
+			}
+			broadcast(item->pkt);
+
+		} else {
+			t = (double)gen_count / rate;
+			pkt[0] = UEV_MOTION;
+			for(i=0; i<6; i++) {
+				pkt[i + 1] = (int32_t)(350.0 * sin(t * (1.0 + i * 0.25)));
+			}
+			pkt[7] = 1000 / rate;	/* period in msec */
+			broadcast(pkt);
+
+			if((gen_count + 1) % 100 == 0) {
+				memset(pkt, 0, sizeof pkt);
+				pkt[0] = UEV_PRESS;
+				pkt[1] = ((gen_count + 1) / 100) % NUM_BUTTONS;
+				broadcast(pkt);
+				pkt[0] = UEV_RELEASE;
+				broadcast(pkt);
+			}
+		}
+
+		gen_count++;
+		next_ev += 1000000.0 / rate;
+	}
+
+	if(stream_state == 2 && verbose) {
+		printf("event stream done, %lu events\n", gen_count);
+	}
+}
+
+/* Sends a config change event to all clients */
+static void cfg_changed(int req, const struct reqresp *rr)
+{
+	int32_t pkt[8];
+
+	pkt[0] = UEV_CFG;
+	pkt[1] = req + 1;	/* the corresponding query */
+	memcpy(pkt + 2, rr->data, 6 * sizeof *pkt);
+	broadcast(pkt);
+}
+
+/* returns the table for per-axis or per-button configuration requests */
+static int32_t *cfg_table(int req)
+{
+	switch(req) {
+	case REQ_SCFG_DEADZONE:
+	case REQ_GCFG_DEADZONE:
+		return cfg.deadzone;
+	case REQ_SCFG_AXISMAP:
+	case REQ_GCFG_AXISMAP:
+		return cfg.axismap;
+	case REQ_SCFG_BNMAP:
+	case REQ_GCFG_BNMAP:
+		return cfg.bnmap;
+	case REQ_SCFG_BNACTION:
+	case REQ_GCFG_BNACTION:
+		return cfg.bnaction;
+	case REQ_SCFG_KBMAP:
+	case REQ_GCFG_KBMAP:
+		return cfg.kbmap;
+	default:
+		break;
+	}
+	return 0;
+}
+
+/* returns the configuration values for the rest of the config requests */
+static int32_t *cfg_value(int req, int *count)
+{
+	*count = 1;
+	switch(req) {
+	case REQ_SCFG_SENS:
+	case REQ_GCFG_SENS:
+		return &cfg.sens;
+	case REQ_SCFG_SENS_AXIS:
+	case REQ_GCFG_SENS_AXIS:
+		*count = 6;
+		return cfg.sens_axis;
+	case REQ_SCFG_INVERT:
+	case REQ_GCFG_INVERT:
+		*count = 6;
+		return cfg.invert;
+	case REQ_SCFG_SWAPYZ:
+	case REQ_GCFG_SWAPYZ:
+		return &cfg.swapyz;
+	case REQ_SCFG_LED:
+	case REQ_GCFG_LED:
+		return &cfg.led;
+	case REQ_SCFG_GRAB:
+	case REQ_GCFG_GRAB:
+		return &cfg.grab;
+	case REQ_SCFG_REPEAT:
+	case REQ_GCFG_REPEAT:
+		return &cfg.repeat;
+	default:
+		break;
+	}
+	return 0;
+}
+
+static void proc_request(struct client *c, struct reqresp *req)
+{
+	int i, code, count, idx, res;
+	int32_t *val;
+	struct reqresp rr;
+
+	/* libspnav doesn't tag string transfers (see spnav_send_str) */
+	code = req->type & 0xffff;
+	memset(&rr, 0, sizeof rr);
+
+	switch(code) {
+	case REQ_SET_NAME:
+		if((res = spnav_recv_str(&c->strbuf, req)) == 1) {
+			free(c->name);
+			c->name = c->strbuf.buf;
+			c->strbuf.buf = 0;
+			if(verbose) printf("client %d: name: %s\n", c->s, c->name);
+		}
+		break;
+
+	case REQ_SET_SENS:
+		c->sens = req->data[0];
+		send_resp(c, code, &rr, 0);
+		break;
+	case REQ_GET_SENS:
+		rr.data[0] = c->sens;
+		send_resp(c, code, &rr, 0);
+		break;
+
+	case REQ_SET_EVMASK:
+		c->evmask = req->data[0];
+		send_resp(c, code, &rr, 0);
+		break;
+	case REQ_GET_EVMASK:
+		rr.data[0] = c->evmask;
+		send_resp(c, code, &rr, 0);
+		break;
+
+	case REQ_DEV_NAME:
+		send_str(c, code, DEV_NAME_STR);
+		break;
+	case REQ_DEV_PATH:
+		send_str(c, code, DEV_PATH_STR);
+		break;
+	case REQ_DEV_NAXES:
+		rr.data[0] = NUM_AXES;
+		send_resp(c, code, &rr, 0);
+		break;
+	case REQ_DEV_NBUTTONS:
+		rr.data[0] = NUM_BUTTONS;
+		send_resp(c, code, &rr, 0);
+		break;
+	case REQ_DEV_USBID:
+		rr.data[0] = 0x256f;
+		rr.data[1] = 0xc635;
+		send_resp(c, code, &rr, 0);
+		break;
+	case REQ_DEV_TYPE:
+		rr.data[0] = DEV_SMCOMP;
+		send_resp(c, code, &rr, 0);
+		break;
+
+	case REQ_SCFG_SERDEV:
+		if((res = spnav_recv_str(&c->strbuf, req)) == 1) {
+			strncpy(cfg.serdev, c->strbuf.buf, sizeof cfg.serdev - 1);
+			send_resp(c, code, &rr, 0);
+		} else if(res == -1) {
+			send_resp(c, code, &rr, -1);
+		}
+		break;
+	case REQ_GCFG_SERDEV:
+		send_str(c, code, cfg.serdev);
+		break;
+
+	case REQ_CFG_SAVE:
+		saved_cfg = cfg;
+		send_resp(c, code, &rr, 0);
+		break;
+	case REQ_CFG_RESTORE:
+	case REQ_CFG_RESET:
+		if(code == REQ_CFG_RESTORE) {
+			cfg = saved_cfg;
+		} else {
+			default_config(&cfg);
+		}
+		send_resp(c, code, &rr, 0);
+		break;
+
+	default:
+		if(code < REQ_SCFG_SENS || code > REQ_GCFG_REPEAT) {
+			if(verbose) printf("client %d: unknown request %x\n", c->s, code);
+			send_resp(c, code, &rr, -1);
+			break;
+		}
+
+		if((val = cfg_table(code))) {
+			idx = req->data[0];
+			if(idx < 0 || idx >= CFG_TABLE_SIZE) {
+				send_resp(c, code, &rr, -1);
+				break;
+			}
+			rr.data[0] = idx;
+			if(code & 1) {
+				rr.data[1] = val[idx];
+				send_resp(c, code, &rr, 0);
+			} else {
+				val[idx] = req->data[1];
+				rr.data[1] = val[idx];
+				send_resp(c, code, &rr, 0);
+				cfg_changed(code, &rr);
+			}
+			break;
+		}
+
+		val = cfg_value(code, &count);
+		if(code & 1) {
+			for(i=0; i<count; i++) {
+				rr.data[i] = val[i];
+			}
+			send_resp(c, code, &rr, 0);
+		} else {
+			for(i=0; i<count; i++) {
+				val[i] = rr.data[i] = req->data[i];
+			}
+			send_resp(c, code, &rr, 0);
+			cfg_changed(code, &rr);
+		}
+	}
+}
+
+static void default_config(struct config *cfg)
+{
+	int i;
+	float one = 1.0f;
+
+	memset(cfg, 0, sizeof *cfg);
+	memcpy(&cfg->sens, &one, sizeof one);
+	for(i=0; i<6; i++) {
+		cfg->sens_axis[i] = cfg->sens;
+	}
+	for(i=0; i<CFG_TABLE_SIZE; i++) {
+		cfg->axismap[i] = i < NUM_AXES ? i : -1;
+		cfg->bnmap[i] = i;
+		cfg->deadzone[i] = 2;
+	}
+	cfg->led = SPNAV_CFG_LED_AUTO;
+	cfg->repeat = -1;
+}
+
+static int load_script(const char *fname)
+{
+	FILE *fp;
+	char buf[MAX_SCRIPT_LINE], *line;
+	int i, max = 0, lineno = 0;
+	long val[7];
+	struct script_item *item, *tmp;
+
+	if(!(fp = fopen(fname, "r"))) {
+		fprintf(stderr, "failed to open script %s: %s\n", fname, strerror(errno));
+		return -1;
+	}
+
+	while(fgets(buf, sizeof buf, fp)) {
+		lineno++;
+		line = buf;
+		while(*line && isspace((unsigned char)*line)) line++;
+		if(!*line || *line == '#') continue;
+
+		if(script_len >= max) {
+			max = max ? max * 2 : 64;
+			if(!(tmp = realloc(script, max * sizeof *script))) {
+				fprintf(stderr, "failed to allocate script\n");
+				goto err;
+			}
+			script = tmp;
+		}
+		item = script + script_len;
+		memset(item, 0, sizeof *item);
+
+		switch(*line) {
+		case 'm':
+			val[6] = rate > 0 ? 1000 / rate : 0;
+			if(sscanf(line + 1, "%ld %ld %ld %ld %ld %ld %ld", val, val + 1, val + 2,
+						val + 3, val + 4, val + 5, val + 6) < 6) {
+				goto inval;
+			}
+			item->pkt[0] = UEV_MOTION;
+			for(i=0; i<7; i++) {
+				item->pkt[i + 1] = val[i];
+			}
+			break;
+
+		case 'p':
+		case 'r':
+			if(sscanf(line + 1, "%ld", val) != 1) goto inval;
+			item->pkt[0] = *line == 'p' ? UEV_PRESS : UEV_RELEASE;
+			item->pkt[1] = val[0];
+			break;
+
+		case 'w':
+			if(sscanf(line + 1, "%ld", &item->pause) != 1 || item->pause <= 0) goto inval;
+			break;
+
+		default:
+			goto inval;
+		}
+		script_len++;
+	}
+	fclose(fp);
+
+	if(!script_len) {
+		fprintf(stderr, "script %s is empty\n", fname);
+		return -1;
+	}
+	return 0;
+
+inval:
+	fprintf(stderr, "%s:%d: invalid script line: %s", fname, lineno, buf);
+err:
+	fclose(fp);
+	free(script);
+	script = 0;
+	script_len = 0;
+	return -1;
+}
+
+/* returns the time in microseconds, since the first call */
+static double get_usec(void)
+{
+	static struct timespec start;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	if(!start.tv_sec && !start.tv_nsec) {
+		start = ts;
+	}
+	return (ts.tv_sec - start.tv_sec) * 1000000.0 + (ts.tv_nsec - start.tv_nsec) / 1000.0;
+}
+
+static void sighandler(int s)
+{
+	quit = 1;
+}